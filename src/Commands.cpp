@@ -2,24 +2,38 @@
 #include <string.h>
 #include <iostream>
 #include <vector>
-#include <sstream>
 #include <limits.h>
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "signals.h"
+#include "output.h"
 #include <time.h>
 #include <algorithm>  
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <map>
+#include <memory>
+#include <sstream>
+#include "script.h"
 
 
 
 using namespace std;
 
-// Error messages
-#define _PRINT_ERROR(ERR, CMD) std::cerr << ERR(CMD) << std::endl;
-#define _PRINT_PERROR(ERR, CMD) perror(ERR(CMD));
-#define _PRINT_ERROR_JOB_ID(ERR_S, ERR_E, CMD, ID) std::cerr <<  ERR_S(CMD) << ID << ERR_E << std::endl;
+// Error messages; each one also fails the line (see smash -e)
+#define _FAIL SmallShell::getInstance().setStatus(1);
+#define _PRINT_ERROR(ERR, CMD) { _FAIL std::cerr << ERR(CMD) << '\n'; }
+#define _PRINT_PERROR(ERR, CMD) { int err_ = errno; _FAIL std::cerr << ERR(CMD) << ": " << strerror(err_) << '\n'; }
+#define _PRINT_ERROR_JOB_ID(ERR_S, ERR_E, CMD, ID) { _FAIL std::cerr <<  ERR_S(CMD) << ID << ERR_E << '\n'; }
 #define SYSCALL_ERROR(CMD)                  "smash error: " CMD " failed"
 #define TOO_MANY_ARGS_ERROR(CMD)            "smash error: " CMD ": too many arguments"
 #define NOT_ENOUGH_ARGS_ERROR(CMD)          "smash error: " CMD ": not enough arguments"
@@ -32,10 +46,20 @@ using namespace std;
 #define JOB_ALREADY_IN_BG_ERROR__END        " is already running in the background"
 #define JOB_LIST_EMPTY_ERROR(CMD)           "smash error: " CMD ": jobs list is empty"
 #define JOBS_NO_STOPPED_ERROR(CMD)          "smash error: " CMD ": there is no stopped jobs to resume"
+#define NOT_FOUND_ERROR_START(CMD)          "smash error: " CMD ": "
+#define NOT_FOUND_ERROR_END                 ": not found"
+#define SAME_FILE_ERROR(CMD)                "smash error: " CMD ": input file is output file"
 #define EXECV    "execv"
 #define TIMEOUT    "timeout"
 #define READ    "read"
+#define WRITE   "write"
 #define HEAD     "head"
+#define CAT      "cat"
+#define TAIL     "tail"
+#define INOTIFY  "inotify"
+#define TEE      "tee"
+#define SPLICE   "splice"
+#define COPY     "copy"
 #define PIPE      "pipe"
 #define DUP       "dup"
 #define CLOSE     "close"
@@ -46,18 +70,28 @@ using namespace std;
 #define FORK      "fork"
 #define KILL      "kill"
 #define CHDIR     "chdir"
-#define BASH_PATH "/bin/bash"
+#define LAUNCHER  "launcher"
+#define HASH      "hash"
+#define PARALLEL  "parallel"
+#define TIMES     "times"
+#define WAIT      "wait"
+#define EPOLL     "epoll"
+
+// Shared by the builtins that stream bytes through smash
+static char io_buffer[IO_BUFFER_SIZE];
 
 // Constants
 const char* WHITESPACE =     " \n\r\t\f\v";
 const char* DEFAULT_PROMPT = "smash";
+// Characters whose meaning only bash knows (quoting, expansions, globs, lists...)
+const char* BASH_SPECIAL_CHARS = "'\"`$\\*?[]{}~;<()#";
 
 #if 0
 #define FUNC_ENTRY()  \
-  cout << __PRETTY_FUNCTION__ << " --> " << endl;
+  cout << __PRETTY_FUNCTION__ << " --> " << '\n';
 
 #define FUNC_EXIT()  \
-  cout << __PRETTY_FUNCTION__ << " <-- " << endl;
+  cout << __PRETTY_FUNCTION__ << " <-- " << '\n';
 #else
 #define FUNC_ENTRY()
 #define FUNC_EXIT()
@@ -65,61 +99,196 @@ const char* DEFAULT_PROMPT = "smash";
 
 
 
-string _ltrim(const std::string& s)
-{
-  size_t start = s.find_first_not_of(WHITESPACE);
-  return (start == std::string::npos) ? "" : s.substr(start);
+// A command is "simple" if smash's own whitespace split gives the same argv and file names bash would
+bool _isSimpleCommand(const SimpleCommand& cmd, char** args, int argc) {
+  // "VAR=value cmd" is an assignment prefix
+  if (argc == 0 || strchr(args[0], '=') != nullptr) {
+    return false;
+  }
+  // and an inner '&' is a list operator
+  for (int i = 0; i < argc; i++) {
+    if (strpbrk(args[i], BASH_SPECIAL_CHARS) != nullptr || strchr(args[i], '&') != nullptr) {
+      return false;
+    }
+  }
+  for (int i = 0; i < cmd.redir_count; i++) {
+    if (strpbrk(cmd.redirs[i].file, BASH_SPECIAL_CHARS) != nullptr) {
+      return false;
+    }
+  }
+  return true;
 }
 
-string _rtrim(const std::string& s)
-{
-  size_t end = s.find_last_not_of(WHITESPACE);
-  return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+/**
+* Sets spec up to exec args directly when smash can resolve them, with cmd's
+* redirections opened into redir for the caller to add after its own fd actions.
+* Otherwise cmd_line goes to bash, which redirects by itself. Returns false if a
+* redirection failed.
+*/
+bool _prepareSpawn(SpawnSpec& spec, Redirector& redir, const SimpleCommand& cmd, const char* cmd_line,
+                   char** args, int argc) {
+  string path;
+  SmallShell& smash = SmallShell::getInstance();
+  bool native = _isSimpleCommand(cmd, args, argc) && smash.launcher.resolve(args[0], path);
+  smash.countSpawn(native);
+  spec.pgid = 0;
+  if (!native) {
+    spec.setBashLine(cmd_line);
+    return true;
+  }
+  spec.setArgs(path, args);
+  if (!redir.open(cmd)) {
+    _FAIL
+    return false;
+  }
+  return true;
 }
 
-string _trim(const std::string& s)
-{
-  return _rtrim(_ltrim(s));
+// Returns cmd_line without its first n words
+string _skipWords(const string& cmd_line, int n) {
+  size_t pos = cmd_line.find_first_not_of(WHITESPACE);
+  for (int i = 0; i < n && pos != string::npos; i++) {
+    pos = cmd_line.find_first_of(WHITESPACE, pos);
+    pos = (pos == string::npos) ? pos : cmd_line.find_first_not_of(WHITESPACE, pos);
+  }
+  return (pos == string::npos) ? "" : cmd_line.substr(pos);
 }
 
-int _parseCommandLine(const char* cmd_line, char** args) {
-  FUNC_ENTRY()
-  int i = 0;
-  std::istringstream iss(_trim(string(cmd_line)).c_str());
-  for (std::string s; iss >> s; ) {
-    args[i] = (char*)malloc(s.length()+1);
-    memset(args[i], 0, s.length()+1);
-    strcpy(args[i], s.c_str());
-    args[++i] = NULL;
+// A line or byte count for head and tail: digits only; returns -1 for anything else
+static long long _parseCount(const char* arg) {
+  char* end;
+  errno = 0;
+  long long num = strtoll(arg, &end, 10);
+  if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno == ERANGE) {
+    return -1;
   }
-  return i;
-
-  FUNC_EXIT()
+  return num;
 }
 
-bool _isBackgroundComamnd(const char* cmd_line) {
-  const string str(cmd_line);
-  return str[str.find_last_not_of(WHITESPACE)] == '&';
+// Accepts "9", "KILL" or "SIGKILL"; returns -1 for anything else
+int _parseSignal(const char* arg) {
+  char* end;
+  long num = strtol(arg, &end, 10);
+  if (end != arg && *end == '\0') {
+    return (num > 0 && num < NSIG) ? (int)num : -1;
+  }
+  if (strncmp(arg, "SIG", 3) == 0) {
+    arg += 3;
+  }
+  for (int sig = 1; sig < NSIG; sig++) {
+    const char* name = sigabbrev_np(sig);
+    if (name != nullptr && strcmp(name, arg) == 0) {
+      return sig;
+    }
+  }
+  return -1;
 }
 
-void _removeBackgroundSign(char* cmd_line) {
-  const string str(cmd_line);
-  // find last character other than spaces
-  unsigned int idx = str.find_last_not_of(WHITESPACE);
-  // if all characters are spaces then return
-  if (idx == string::npos) {
-    return;
+// write(2) until all of buf is out, retrying short writes and EINTR
+bool _writeAll(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, buf, len);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    len -= written;
   }
-  // if the command line does not end with & then return
-  if (cmd_line[idx] != '&') {
-    return;
+  return true;
+}
+
+bool _isPipe(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/**
+* Moves up to len bytes (len < 0: until EOF) from in_fd to out_fd and returns how
+* many moved, or -1. Between two regular files copy_file_range(2) keeps the data
+* in the filesystem; otherwise splice(2) is used when either side is a pipe and
+* sendfile(2) when the source is a file, so the data only goes through our buffer
+* when none of them fits.
+*/
+long long _copyFd(int in_fd, int out_fd, long long len) {
+  long long total = 0;
+  struct stat in_st, out_st;
+  bool known = (fstat(in_fd, &in_st) == 0 && fstat(out_fd, &out_st) == 0);
+  bool file_range = known && S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode);
+  // splice(2) must not sleep on an empty pipe while holding a regular file's offset:
+  // it stores it back on return, over what others sharing the file wrote meanwhile
+  bool wait_input = known && S_ISFIFO(in_st.st_mode) && S_ISREG(out_st.st_mode);
+  bool zero_copy = true;
+  while (len != 0) {
+    size_t chunk = (len < 0 || len > PIPE_CHUNK_SIZE) ? PIPE_CHUNK_SIZE : len;
+    ssize_t moved;
+    if (file_range) {
+      moved = copy_file_range(in_fd, nullptr, out_fd, nullptr, chunk, 0);
+      // across filesystems, on ones that can't, or onto an O_APPEND file
+      if (moved == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP ||
+                          errno == EBADF)) {
+        file_range = false;
+        continue;
+      }
+    }
+    else if (zero_copy) {
+      moved = splice(in_fd, nullptr, out_fd, nullptr, chunk,
+                     SPLICE_F_MOVE | SPLICE_F_MORE | (wait_input ? SPLICE_F_NONBLOCK : 0));
+      if (moved == -1 && errno == EAGAIN && wait_input) {
+        struct pollfd input = {in_fd, POLLIN, 0};
+        if (poll(&input, 1, -1) == -1 && errno != EINTR) {
+          return -1;
+        }
+        continue;
+      }
+      if (moved == -1 && errno == EINVAL) {
+        moved = sendfile(out_fd, in_fd, nullptr, chunk);
+      }
+      if (moved == -1 && (errno == EINVAL || errno == ENOSYS)) {
+        zero_copy = false;
+        continue;
+      }
+    }
+    else {
+      moved = read(in_fd, io_buffer, min(chunk, sizeof(io_buffer)));
+      if (moved > 0 && !_writeAll(out_fd, io_buffer, moved)) {
+        return -1;
+      }
+    }
+    if (moved == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (moved == 0) {
+      break;
+    }
+    total += moved;
+    len -= (len < 0) ? 0 : moved;
   }
-  // replace the & (background sign) with space and then remove all tailing spaces.
-  cmd_line[idx] = ' ';
-  // truncate the command line string up to the last non-space character
-  cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
+  return total;
 }
 
+/**
+* Before a read that may block on a tty, pipe or FIFO. smash itself only sees
+* ctrl-C through its event loop, so it sleeps there until fd is readable, and
+* returns false if ctrl-C came first. A forked smash takes signals like any process.
+*/
+static bool _awaitInput(int fd) {
+  SmallShell& smash = SmallShell::getInstance();
+  if (getpid() != smash.get_pid()) {
+    return true;
+  }
+  while (!smash.events.wait(fd)) {
+    if (smash.interrupted != 0) {
+      return false;
+    }
+  }
+  return true;
+}
 
 int argToInt(char* arg) {
   int ret = -1;
@@ -132,132 +301,378 @@ int argToInt(char* arg) {
   return ret;
 }
 
+// glibc only wraps the pidfd calls from 2.36 on, and not in every build
+static int _pidfdOpen(pid_t pid) {
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+static int _pidfdSendSignal(int pidfd, int sig) {
+  return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0);
+}
+
+// "real 1.250s user 0.830s sys 0.020s maxrss 5120KB ctxsw 12+3"
+static void _printUsage(std::ostream& out, long long real_nsecs, const Usage& usage) {
+  out << std::fixed << std::setprecision(3) << "real " << real_nsecs / 1e9 << "s user " << usage.user_usecs / 1e6
+      << "s sys " << usage.sys_usecs / 1e6 << "s maxrss " << usage.maxrss_kb << "KB ctxsw "
+      << usage.vcsw << "+" << usage.ivcsw;
+  out.unsetf(std::ios::floatfield);
+}
+
 /*** SmallShell class ***/
-SmallShell::SmallShell() : oldwd_exist(false), curr_job(nullptr) {
+SmallShell::SmallShell() : prompt(DEFAULT_PROMPT), oldwd_exist(false), native_spawns(0), bash_spawns(0), status(0),
+    report_usage(false), curr_job(nullptr), interrupted(0), reap_log(nullptr) {
   this->oldwd = (char*)malloc(PATH_MAX);
-  this->prompt = (char*)malloc(COMMAND_ARGS_MAX_LENGTH);
-  strcpy(this->prompt, DEFAULT_PROMPT);
   this->pid = getpid();
 }
 
 SmallShell::~SmallShell() {
   free(oldwd);
-  free(prompt);
 }
 
 /**
-* Creates and returns a pointer to Command class which matches the given command line (cmd_line)
+* Creates the Command which matches the given parsed line. The caller owns it
+* and drops it once it ran; a job it starts keeps its own copy of the line.
 */
-Command * SmallShell::CreateCommand(const char* cmd_line) {
-  string cmd_s = _trim(string(cmd_line));
-  string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-
-  if (firstWord[firstWord.size() - 1] == '&') {
-    firstWord = firstWord.substr(0, firstWord.size() - 1);
-  }
-  if (cmd_s.find('>') != std::string::npos) {
-    return new RedirectionCommand(cmd_line, &jl);
+std::unique_ptr<Command> SmallShell::CreateCommand(const CommandLine& line) {
+  if (line.count > 1) {
+    return std::unique_ptr<Command>(new PipeCommand(line));
   }
-  else if (cmd_s.find('|') != std::string::npos) {
-    return new PipeCommand(cmd_line);
+  const SimpleCommand& simple = line.commands[0];
+  string_view firstWord = (simple.argc > 0) ? simple.argv[0] : "";
+  const BuiltinEntry* builtin = findBuiltin(firstWord);
+  // options a builtin stand-in for a utility doesn't know go to the utility itself
+  if (builtin != nullptr && builtin->handles != nullptr && !builtin->handles(simple)) {
+    builtin = nullptr;
   }
-  else if (firstWord.compare("timeout") == 0) {
-    return new TimeoutCommand(cmd_line);
+  // commands that spawn (externals, timeout) apply their own redirections
+  if (simple.redir_count > 0 && (simple.argc == 0 || (builtin != nullptr && (builtin->flags & BUILTIN_IN_PROCESS)))) {
+    return std::unique_ptr<Command>(new RedirectionCommand(line, builtin ? builtin->flags : 0));
   }
-  else if (firstWord.compare("pwd") == 0) {
-    return new GetCurrDirCommand(cmd_line);
+  if (builtin != nullptr) {
+    return std::unique_ptr<Command>(builtin->create(line, *this));
   }
-  else if (firstWord.compare("showpid") == 0) {
-    return new ShowPidCommand(cmd_line);
-  }
-  else if (firstWord.compare("chprompt") == 0) {
-    return new ChangePromptCommand(cmd_line, &this->prompt);
-  }
-  else if (firstWord.compare("cd") == 0) {
-    return new ChangeDirCommand(cmd_line, &this->oldwd, &this->oldwd_exist);
-  }
-  else if (firstWord.compare("jobs") == 0) {
-    return new JobsCommand(cmd_line, &this->jl);
-  }
-  else if (firstWord.compare("kill") == 0) {
-    return new KillCommand(cmd_line, &this->jl);
-  }
-  else if (firstWord.compare("fg") == 0) {
-    return new ForegroundCommand(cmd_line, &this->jl);
-  }
-  else if (firstWord.compare("bg") == 0) {
-    return new BackgroundCommand(cmd_line, &this->jl);
-  }
-  else if (firstWord.compare("quit") == 0) {
-    return new QuitCommand(cmd_line, &this->jl);
+  return std::unique_ptr<Command>(new ExternalCommand(line));
+}
+
+// cat takes no options of its own
+static bool _catHandles(const SimpleCommand& cmd) {
+  for (int i = 1; i < cmd.argc; i++) {
+    if (cmd.argv[i][0] == '-' && cmd.argv[i][1] != '\0') {
+      return false;
+    }
   }
-  else if (firstWord.compare("head") == 0) {
-    return new HeadCommand(cmd_line);
+  return true;
+}
+
+// tail [-N | -n N | -c N] [-f] [FILE | -]; "+N" counts and the other options are left to tail(1)
+static bool _tailHandles(const SimpleCommand& cmd) {
+  bool file = false;
+  for (int i = 1; i < cmd.argc; i++) {
+    const char* arg = cmd.argv[i];
+    if ((strcmp(arg, "-n") == 0 || strcmp(arg, "-c") == 0) && i + 1 < cmd.argc) {
+      if (_parseCount(cmd.argv[++i]) < 0) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "-f") == 0) {
+      continue;
+    }
+    else if (arg[0] == '-' && arg[1] != '\0') {
+      if (_parseCount(arg + 1) < 0) {
+        return false;
+      }
+    }
+    else if (file) {
+      return false;
+    }
+    else {
+      file = true;
+    }
   }
-  else {
-    return new ExternalCommand(cmd_line);
+  return true;
+}
+
+template <size_t N>
+static constexpr bool _isSortedByName(const BuiltinEntry (&table)[N]) {
+  for (size_t i = 1; i < N; i++) {
+    if (string_view(table[i - 1].name) >= string_view(table[i].name)) {
+      return false;
+    }
   }
+  return true;
+}
 
+/**
+* The builtin registry: one row per command smash runs itself, sorted by name so
+* a lookup is a binary search. New builtins only need a row here.
+*/
+const BuiltinEntry* SmallShell::findBuiltin(string_view name) {
+  static constexpr BuiltinEntry builtins[] = {
+    {"bg", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new BackgroundCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS},
+    {"cat", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new CatCommand(line);
+    }, BUILTIN_IN_PROCESS | BUILTIN_RAW_FDS, _catHandles},
+    {"cd", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new ChangeDirCommand(line, &smash.oldwd, &smash.oldwd_exist);
+    }, BUILTIN_IN_PROCESS},
+    {"chprompt", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new ChangePromptCommand(line, &smash.prompt);
+    }, BUILTIN_IN_PROCESS},
+    {"fg", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new ForegroundCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS},
+    {"hash", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new HashCommand(line, &smash.launcher.path_cache);
+    }, BUILTIN_IN_PROCESS},
+    {"head", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new HeadCommand(line);
+    }, BUILTIN_IN_PROCESS | BUILTIN_RAW_FDS},
+    {"jobs", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new JobsCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS | BUILTIN_PIPELINE},
+    {"kill", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new KillCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS},
+    {"launcher", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new LauncherCommand(line, &smash.launcher);
+    }, BUILTIN_IN_PROCESS},
+    {"parallel", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new ParallelCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS | BUILTIN_RAW_FDS},
+    {"pwd", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new GetCurrDirCommand(line);
+    }, BUILTIN_IN_PROCESS | BUILTIN_PIPELINE},
+    {"quit", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new QuitCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS},
+    {"showpid", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new ShowPidCommand(line);
+    }, BUILTIN_IN_PROCESS | BUILTIN_PIPELINE},
+    {"stats", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new StatsCommand(line);
+    }, BUILTIN_IN_PROCESS | BUILTIN_PIPELINE},
+    {"tail", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new TailCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS | BUILTIN_RAW_FDS, _tailHandles},
+    {"tee", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new TeeCommand(line);
+    }, BUILTIN_IN_PROCESS | BUILTIN_RAW_FDS},
+    {"timeout", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new TimeoutCommand(line);
+    }, 0},
+    {"times", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new TimesCommand(line, &smash.report_usage);
+    }, BUILTIN_IN_PROCESS},
+    {"wait", [](const CommandLine& line, SmallShell& smash) -> Command* {
+      return new WaitCommand(line, &smash.jl);
+    }, BUILTIN_IN_PROCESS},
+  };
+  static_assert(_isSortedByName(builtins), "the builtin registry must stay sorted by name");
+
+  size_t low = 0;
+  size_t high = sizeof(builtins) / sizeof(builtins[0]);
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    int cmp = name.compare(builtins[mid].name);
+    if (cmp == 0) {
+      return &builtins[mid];
+    }
+    if (cmp < 0) {
+      high = mid;
+    }
+    else {
+      low = mid + 1;
+    }
+  }
   return nullptr;
 }
 
-void SmallShell::executeCommand(const char *cmd_line) {
+/**
+* Parses cmd_line and runs it. Whatever the parse put in the arena is dropped once
+* the line is done, but not before: a nested line must not free its caller's data.
+*/
+void SmallShell::executeCommand(std::string_view cmd_line) {
+  Arena::Mark mark = parser.mark();
+  try {
+    executeLine(*parser.parse(cmd_line));
+  } catch (std::bad_alloc&) {
+  }
+  parser.release(mark);
+}
+
+void SmallShell::executeLine(const CommandLine& line) {
   // clear finished jobs before executing a new one
-  //setbuf(stdout, NULL);
-  timeoutlist.removeFinishedJobs(false);
-  jl.removeFinishedJobs();
+  reapJobs();
 
-  if (string(cmd_line).empty()) {
+  if (line.count == 1 && line.commands[0].argc == 0 && line.commands[0].redir_count == 0) {
     return;
   }
-  Command* cmd;
+  status = 0;
+  std::unique_ptr<Command> cmd;
   try {
-    cmd = CreateCommand(cmd_line);
+    cmd = CreateCommand(line);
   } catch (std::bad_alloc&) {
+    status = 1;
     return;
   }
 
   if(cmd == nullptr) return;
+  cmd->execute();
+}
 
-  // check if Built-In Command
-  if (dynamic_cast<BuiltInCommand*>(cmd) != nullptr) {
-    bool isQuitCmd = (dynamic_cast<QuitCommand*>(cmd) != nullptr);
-    cmd->execute();
-    delete cmd;
-    if (isQuitCmd) {
-      exit(0);
-    }
+const char* SmallShell::getPrompt() {
+  return this->prompt.c_str();
+}
+
+pid_t SmallShell::get_pid() {
+  return this->pid;
+}
+
+// With "times on", each foreground job ends with a line of what it used, on stderr
+void SmallShell::reportUsage(int job_id) {
+  JobsList::JobEntry* je = jl.getJobById(job_id);
+  if (!report_usage || je == nullptr) {
+    return;
+  }
+  std::cerr << "smash: " << je->getJobCmd() << ": ";
+  _printUsage(std::cerr, je->getRealNsecs(), je->getUsage());
+  std::cerr << '\n';
+}
+
+/**
+* Called first thing in a forked smash: the event loop and timers must not be
+* shared with the parent, and the parent's waits are not the child's.
+*/
+void SmallShell::becomeChild() {
+  timers.reset();
+  events.reset(timers.getFd());
+  reap_log = nullptr;
+  curr_job = nullptr;
+}
+
+// Exit status of the last line: its last foreground process's, or 1 if smash reported an error
+int SmallShell::getStatus() {
+  return this->status;
+}
+
+void SmallShell::setStatus(int status) {
+  this->status = status;
+}
+
+// A wait status as the shell reports it: the exit code, or 128 + the signal
+static int _exitCode(int wstatus) {
+  if (WIFEXITED(wstatus)) {
+    return WEXITSTATUS(wstatus);
   }
-  else if (dynamic_cast<ExternalCommand*>(cmd) != nullptr) {
-    cmd->execute();
+  if (WIFSIGNALED(wstatus)) {
+    return 128 + WTERMSIG(wstatus);
   }
-  else if (dynamic_cast<TimeoutCommand*>(cmd) != nullptr) {
-    cmd->execute();
+  if (WIFSTOPPED(wstatus)) {
+    return 128 + WSTOPSIG(wstatus);
+  }
+  return 0;
+}
+
+/**
+* Drops the jobs of every child the SIGCHLD handler reaped since the last call.
+*/
+void SmallShell::reapJobs() {
+  bool more = true;
+  while (more) {
+    chldHandler(SIGCHLD);
+    // a full queue left zombies behind: drain it and reap them next
+    more = ReapQueue::takeOverflow();
+    ReapQueue::Entry entry;
+    while (ReapQueue::pop(entry)) {
+      settleReaped(entry);
+      if (reap_log != nullptr) {
+        reap_log->push_back(entry);
+      }
+    }
   }
-  else if (dynamic_cast<PipeCommand*>(cmd) != nullptr) {
-    cmd->execute();
-    if(dynamic_cast<PipeCommand*>(cmd)->isSon) {
-      delete cmd;
-      exit(0);
+}
+
+// Hands a reaped child's usage and status to its job, which is then dropped; safe to repeat
+void SmallShell::settleReaped(const ReapQueue::Entry& entry) {
+  timers.cancel(entry.pid);
+  jl.addUsage(entry.pid, entry.usage);
+  jl.setExitStatus(entry.pid, _exitCode(entry.status));
+  jl.removeJobByPid(entry.pid);
+}
+
+/**
+* Waits for a foreground child to exit or stop and returns its wait status.
+* If the SIGCHLD handler reaped it first, the status is taken from its queue.
+* The line's status becomes the child's.
+*/
+int SmallShell::waitJob(pid_t pid) {
+  while (true) {
+    ReapQueue::Entry entry;
+    while (ReapQueue::pop(entry)) {
+      if (entry.pid == pid) {
+        status = _exitCode(entry.status);
+        jl.addUsage(pid, entry.usage);
+        return entry.status;
+      }
+      settleReaped(entry);
+    }
+    int wstatus;
+    struct rusage ru;
+    pid_t waited = wait4(pid, &wstatus, WNOHANG | WUNTRACED, &ru);
+    if (waited == pid) {
+      status = _exitCode(wstatus);
+      if (!WIFSTOPPED(wstatus)) {
+        Usage usage = Usage();
+        usage.add(ru);
+        jl.addUsage(pid, usage);
+      }
+      return wstatus;
     }
-    delete cmd;
+    // ECHILD: reapJobs (from a timeout) took it off the queue before we saw it
+    if (waited == -1 && errno != EINTR) {
+      return 0;
+    }
+    // SIGCHLD comes for a stop as well as an exit, so this wakes up for either
+    events.wait();
   }
-  else if (dynamic_cast<RedirectionCommand*>(cmd) != nullptr) {
-    cmd->execute();
-    bool isQuitCmd = (string(cmd->getArgs()[0]).compare("quit") == 0);
-    delete cmd;
-    if (isQuitCmd) {
-      exit(0);
+}
+
+/**
+* Waits for each process of a foreground job in turn and returns the status of
+* the last one, or the first stop. Every process but the last is dropped from
+* the job as it exits, so the caller still owns the job when this returns.
+*/
+int SmallShell::waitPids(const std::vector<pid_t>& pids) {
+  int status = 0;
+  for (size_t i = 0; i < pids.size(); i++) {
+    status = waitJob(pids[i]);
+    if (WIFSTOPPED(status)) {
+      return status;
+    }
+    if (i + 1 < pids.size()) {
+      jl.removeJobByPid(pids[i]);
     }
   }
+  return status;
 }
 
-const char* SmallShell::getPrompt() {
-  return this->prompt;
+void SmallShell::countSpawn(bool native) {
+  if (native) {
+    native_spawns++;
+  }
+  else {
+    bash_spawns++;
+  }
 }
 
-pid_t SmallShell::get_pid() {
-  return this->pid;
+long SmallShell::getNativeSpawns() {
+  return this->native_spawns;
+}
+
+long SmallShell::getBashSpawns() {
+  return this->bash_spawns;
 }
 /*** SmallShell class END ***/
 
@@ -265,179 +680,197 @@ pid_t SmallShell::get_pid() {
 
 
 /*** JobList class ***/
-JobsList::JobsList() {
-  
+JobsList::JobsList() : max_job_id(0), count(0) {
+  slots.push_back(nullptr);
 }
 
 JobsList::~JobsList() {
+  for (JobEntry* je : slots) {
+    if (je != nullptr) {
+      entries.destroy(je);
+    }
+  }
+}
 
+// Unlinks a job and gives its entry back to the pool
+void JobsList::removeSlot(int jobId) {
+  JobEntry* je = slots[jobId];
+  finished[jobId] = je->getExitStatus();
+  pid_index.erase(je->getJobPid());
+  for (pid_t process : je->getRunningPids()) {
+    pid_index.erase(process);
+  }
+  slots[jobId] = nullptr;
+  count--;
+  if (jobId == max_job_id) {
+    while (max_job_id > 0 && slots[max_job_id] == nullptr) {
+      max_job_id--;
+    }
+    slots.resize(max_job_id + 1);
+  }
+  entries.destroy(je);
 }
 
-void  JobsList::addJob(Command* cmd, bool isStopped, pid_t pid) {
-  this->removeFinishedJobs();
-  int job_id = getHighestJobID() + 1;
+/**
+* The job takes cmd's command line over: cmd is done with it once it has a job,
+* and is deleted by whoever ran it. pidfd, if the launcher already has one for
+* pid, is handed over too.
+*/
+void  JobsList::addJob(Command& cmd, bool isStopped, pid_t pid, int pidfd) {
+  int job_id = max_job_id + 1;
   JobEntry* je;
   try {
-    je = new JobEntry(cmd, job_id, isStopped, pid);
+    je = entries.create(cmd.takeCmdLine(), cmd.takeOldCmdLine(), job_id, isStopped, pid, pidfd);
+    slots.push_back(je);
+    pid_index[pid] = job_id;
+    finished.erase(job_id);
   }
   catch (std::bad_alloc&) {
+    if (pidfd != -1) {
+      close(pidfd);
+    }
     return;
   }
-  jobs.push_back(je);
+  max_job_id = job_id;
+  count++;
 }
 
-int JobsList::getHighestJobID() {
-  int max_job_id = 0;
-  for (auto x: jobs) {
-    max_job_id = max(max_job_id, x->getJobId());
+// Adds another process (e.g. a later pipeline stage) to an existing job
+void JobsList::addJobProcess(int jobId, pid_t pid) {
+  JobEntry* je = getJobById(jobId);
+  if (je == nullptr) {
+    return;
   }
+  je->addProcess(pid);
+  pid_index[pid] = jobId;
+}
+
+int JobsList::getHighestJobID() {
   return max_job_id;
 }
 
 int JobsList::size() {
-  return jobs.size();
+  return count;
 }
 
 void JobsList::printKillJobs() {
-  for (auto x: jobs) {
-    std::cout << x->getJobPid() << ": " << x->getOldCmdLine() << std::endl;
+  for (auto x: slots) {
+    if (x != nullptr) {
+      std::cout << x->getJobPid() << ": " << x->getOldCmdLine() << '\n';
+    }
   }
 }
 
-void  JobsList::printJobsList() {
-  sort(jobs.begin(), jobs.end(), JobsList::JobIsBigger());
-  time_t curr_time;
-  time(&curr_time);
-  for (size_t i = 0; i < jobs.size(); i++) {
-    fprintf(stdout, "[%d] %s : %d %d secs", jobs[i]->getJobId(), jobs[i]->getOldCmdLine(), jobs[i]->getJobPid(), (int)difftime(curr_time, jobs[i]->getJobInsertTime()));
-    if (jobs[i]->JobIsStopped()) fprintf(stdout, " (stopped)\n");
-    else fprintf(stdout, "\n");
+void JobsList::addUsage(pid_t pid, const Usage& usage) {
+  JobEntry* je = getJobByPid(pid);
+  if (je != nullptr) {
+    je->addUsage(usage);
   }
 }
 
-void  JobsList::killAllJobs() {
-  while (jobs.size() != 0) {
-    kill(jobs.back()->getJobPid(), SIGKILL);
-    delete jobs.back();
-    jobs.pop_back();
+void JobsList::setExitStatus(pid_t pid, int status) {
+  JobEntry* je = getJobByPid(pid);
+  if (je != nullptr) {
+    je->setExitStatus(pid, status);
   }
 }
 
-void  JobsList::removeFinishedJobs(bool del) {
-  auto iter = jobs.begin();
-  while (iter != jobs.end())
-  {
-    int status;       
-    if (waitpid((*iter)->getJobPid(), &status, WNOHANG) > 0 || kill((*iter)->getJobPid(), 0) == -1) {
-      if (del) {
-        delete *iter;
-      }
-      iter = jobs.erase(iter);
-    }
-    else {
-      ++iter;
-    }
+// The exit status of a job that is no longer listed, once
+bool JobsList::takeExitStatus(int jobId, int* status) {
+  auto iter = finished.find(jobId);
+  if (iter == finished.end()) {
+    return false;
   }
+  *status = iter->second;
+  finished.erase(iter);
+  return true;
 }
 
-JobsList::JobEntry*  JobsList::getJobById(int jobId) {
-  for (size_t i = 0; i < jobs.size(); i++) {
-    if (jobs[i]->getJobId() == jobId) {
-      return jobs[i];
+void  JobsList::printJobsList(bool verbose) {
+  time_t curr_time;
+  time(&curr_time);
+  for (auto x: slots) {
+    if (x == nullptr) {
+      continue;
     }
+    std::cout << "[" << x->getJobId() << "] " << x->getOldCmdLine() << " : " << x->getJobPid() << " "
+              << (int)difftime(curr_time, x->getJobInsertTime()) << " secs";
+    if (x->JobIsStopped()) std::cout << " (stopped)";
+    if (verbose) {
+      std::cout << "\n    ";
+      _printUsage(std::cout, x->getRealNsecs(), x->getUsage());
+    }
+    std::cout << '\n';
   }
-  return nullptr;
 }
 
-void  JobsList::removeJobById(int jobId, bool del) {
-  for (size_t i = 0; i < jobs.size(); i++) {
-    if (jobs[i]->getJobId() == jobId) {
-      if(del) delete *(jobs.begin() + i);
-      jobs.erase(jobs.begin() + i);
-      return;
-    }
+void  JobsList::killAllJobs() {
+  while (max_job_id != 0) {
+    slots[max_job_id]->signalJob(SIGKILL);
+    removeSlot(max_job_id);
   }
 }
 
-void JobsList::removeJobByPid(int jobPid, bool del) {
-  for (size_t i = 0; i < jobs.size(); i++) {
-    if (jobs[i]->getJobPid() == jobPid) {
-      if(del) delete *(jobs.begin() + i);
-      jobs.erase(jobs.begin() + i);
-      return;
-    }
+JobsList::JobEntry*  JobsList::getJobById(int jobId) {
+  if (jobId <= 0 || jobId > max_job_id) {
+    return nullptr;
   }
+  return slots[jobId];
 }
 
-Command* JobsList::JobEntry::getCmd() {
-  return this->cmd;
+JobsList::JobEntry* JobsList::getJobByPid(pid_t pid) {
+  auto iter = pid_index.find(pid);
+  return (iter == pid_index.end()) ? nullptr : slots[iter->second];
 }
 
-JobsList::JobEntry*  JobsList::getLastJob(int* lastJobId) {
-  time_t lj_time = LONG_MAX;
-  int idx = -1;
-  for (size_t i = 0; i < jobs.size(); i++) {
-    time_t t = LONG_MAX;
-    time(&t);
-    time_t k = abs(t - jobs[i]->getJobInsertTime() - argToInt(jobs[i]->getCmd()->getArgs()[1])) ;
-    if ( k < lj_time) {
-      idx = i;
-      lj_time = k;
-    }
+void  JobsList::removeJobById(int jobId) {
+  if (getJobById(jobId) != nullptr) {
+    removeSlot(jobId);
   }
+}
 
-  if (idx != -1) {
-    *lastJobId = jobs[idx]->getJobId();
-    return jobs[idx];
-  } 
-
-  return nullptr;
+// A job is only removed once the last of its processes is gone
+void JobsList::removeJobByPid(int jobPid) {
+  auto iter = pid_index.find(jobPid);
+  if (iter == pid_index.end()) {
+    return;
+  }
+  int job_id = iter->second;
+  if (slots[job_id]->processExited(jobPid)) {
+    removeSlot(job_id);
+  }
+  else {
+    pid_index.erase(iter);
+  }
 }
 
 JobsList::JobEntry* JobsList::getLastStoppedJob(int *jobId) {
-  int max_job_id = 0;
-  JobsList::JobEntry* max_job = nullptr;
-  for (auto x: jobs) {
-    if (x->getJobId() > max_job_id && x->JobIsStopped()) {
-      max_job_id = x->getJobId();
-      max_job = x;
+  for (int job_id = max_job_id; job_id > 0; job_id--) {
+    if (slots[job_id] != nullptr && slots[job_id]->JobIsStopped()) {
+      *jobId = job_id;
+      return slots[job_id];
     }
   }
-  *jobId = max_job_id;
-  return max_job;
+  *jobId = 0;
+  return nullptr;
 }
 
   
   
-bool JobsList::JobIsBigger::operator()(const JobsList::JobEntry* j1, const JobsList::JobEntry* j2){
-  return j1->getJobId() < j2->getJobId();
-}
-
-bool JobsList::JobIsTimeout::operator()(JobsList::JobEntry* j1, JobsList::JobEntry* j2){
-  return j1->getJobInsertTime() + argToInt(j1->getCmd()->getArgs()[1]) < j2->getJobInsertTime() + argToInt(j2->getCmd()->getArgs()[1]);
-}
-
-void JobsList::sortTimeout() {
-  sort(jobs.begin(), jobs.end(), JobsList::JobIsTimeout());
-}
-
-void JobsList::setAlarm() {
-  time_t t;
-  time(&t);
-  if(this->size() != 0) alarm(this->jobs[0]->getJobInsertTime() + argToInt(this->jobs[0]->getCmd()->getArgs()[1]) - t);
-}
-
-JobsList::JobEntry* JobsList::getFirst() {
-  if(this->size() == 0) return nullptr;
-  return this->jobs[0];
-}
 /*** JobList class END ***/
 
 
 
 
 /*** JobEntry class ***/
-JobsList::JobEntry::JobEntry(Command* cmd, int job_id, bool isStopped, pid_t pid) : job_id(job_id), pid(pid),  isStopped(isStopped), cmd(cmd) {
+/**
+* Children are only reaped on the main flow, so pid is at worst a zombie here and
+* the pidfd opened for it can't name a process that reused the number.
+*/
+JobsList::JobEntry::JobEntry(std::string&& cmd_line, std::string&& org_cmd_line, int job_id, bool isStopped, pid_t pid, int pidfd) :
+    job_id(job_id), pid(pid),  isStopped(isStopped), pidfd((pidfd != -1) ? pidfd : _pidfdOpen(pid)),
+    cmd_line(std::move(cmd_line)), org_cmd_line(std::move(org_cmd_line)), running({pid}), last_pid(pid), exit_status(0),
+    start_nsecs(TimerQueue::now()), usage() {
   time(&this->insert_time);
 }
 
@@ -461,12 +894,12 @@ void JobsList::JobEntry::setStopped(bool val) {
   this->isStopped = val;
 }
 
-char* JobsList::JobEntry::getJobCmd() {
-  return this->cmd->getCmdLine();
+const char* JobsList::JobEntry::getJobCmd() {
+  return this->cmd_line.c_str();
 }
 
 const char* JobsList::JobEntry::getOldCmdLine() {
-  return this->cmd->getOldCmdLine();
+  return this->org_cmd_line.c_str();
 }
 
 time_t JobsList::JobEntry::getJobInsertTime() {
@@ -481,9 +914,95 @@ int JobsList::JobEntry::getJobPid() {
   return this->pid;
 }
 
+int JobsList::JobEntry::getPidfd() {
+  return this->pidfd;
+}
+
+const std::vector<pid_t>& JobsList::JobEntry::getRunningPids() {
+  return this->running;
+}
+
+void JobsList::JobEntry::addProcess(pid_t process) {
+  this->running.push_back(process);
+  this->last_pid = process;
+}
+
+void JobsList::JobEntry::setExitStatus(pid_t process, int status) {
+  if (process == last_pid) {
+    this->exit_status = status;
+  }
+}
+
+int JobsList::JobEntry::getExitStatus() {
+  return this->exit_status;
+}
+
+// Returns true once no process of the job is left running
+bool JobsList::JobEntry::processExited(pid_t process) {
+  auto iter = std::find(running.begin(), running.end(), process);
+  if (iter != running.end()) {
+    running.erase(iter);
+  }
+  return running.empty();
+}
+
+/**
+* Every job leads its own process group, so this reaches all of its processes.
+* pidfd_send_signal can't address a group, so the leader's pidfd vouches for it
+* first: once the leader is reaped and no other process of the job is left, the
+* group id may already belong to someone else.
+*/
+int JobsList::JobEntry::signalJob(int sig) {
+  if (pidfd != -1 && _pidfdSendSignal(pidfd, 0) == -1 && errno == ESRCH &&
+      (running.empty() || (running.size() == 1 && running[0] == pid))) {
+    return -1;
+  }
+  return kill(-this->pid, sig);
+}
+
+void JobsList::JobEntry::addUsage(const Usage& exited) {
+  usage.add(exited);
+}
+
+/**
+* The exited processes' usage as wait4 reported it, plus what /proc shows for the
+* ones still running (CPU time and current RSS; their context switches stay uncounted).
+*/
+Usage JobsList::JobEntry::getUsage() {
+  Usage total = usage;
+  static long ticks = sysconf(_SC_CLK_TCK);
+  static long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+  for (pid_t process : running) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", process);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      continue;
+    }
+    char stat[1024];
+    ssize_t len = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    // the command name may hold spaces and parens: fields are counted from the last ')'
+    char* fields = (len > 0) ? (stat[len] = '\0', strrchr(stat, ')')) : nullptr;
+    unsigned long long utime, stime;
+    long rss;
+    if (fields != nullptr && sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+                                    "%*d %*d %*d %*d %*d %*d %*u %*u %ld", &utime, &stime, &rss) == 3) {
+      total.user_usecs += utime * 1000000LL / ticks;
+      total.sys_usecs += stime * 1000000LL / ticks;
+      total.maxrss_kb = max(total.maxrss_kb, rss * page_kb);
+    }
+  }
+  return total;
+}
+
+long long JobsList::JobEntry::getRealNsecs() {
+  return TimerQueue::now() - start_nsecs;
+}
+
 JobsList::JobEntry::~JobEntry() {
-  if(cmd) {
-    delete cmd;
+  if (pidfd != -1) {
+    close(pidfd);
   }
 }
 /*** JobEntry class END ***/
@@ -493,16 +1012,8 @@ JobsList::JobEntry::~JobEntry() {
 
 
 /*** Command class ***/
-Command::Command(const char* cmd_line_t) {
-  cmd_line = (char*)malloc(COMMAND_ARGS_MAX_LENGTH);
-  org_cmd_line = (char*)malloc(COMMAND_ARGS_MAX_LENGTH);
-  strcpy(cmd_line, cmd_line_t);
-  strcpy(org_cmd_line, cmd_line_t);
-  _removeBackgroundSign(cmd_line);
-  args = new char*[COMMAND_MAX_ARGS + 1];
-  argc = _parseCommandLine(cmd_line, args);
-  isBgCmd = _isBackgroundComamnd(cmd_line_t);
-};
+Command::Command(const CommandLine& line, CommandKind kind) : cmd_line(line.body), org_cmd_line(line.text),
+    argc(line.commands[0].argc), args(line.commands[0].argv), line(line), isBgCmd(line.background), kind(kind) {};
 
 bool Command::getIsBgCmd() {
   return isBgCmd;
@@ -512,23 +1023,35 @@ char** Command::getArgs() {
   return args;
 };
 
-Command::~Command() {
-  if(args) {
-    for(int i = 0; i < argc; i++) {
-      free(args[i]);
-    }
-    delete[] args;
-  }
-  free(org_cmd_line);
-  free(cmd_line);
-};
+Command::~Command() {};
 
-char* Command::getCmdLine() {
-  return this->cmd_line;
+const char* Command::getCmdLine() {
+  return this->cmd_line.c_str();
 };
 
 const char* Command::getOldCmdLine() {
-  return this->org_cmd_line;
+  return this->org_cmd_line.c_str();
+};
+
+std::string Command::takeCmdLine() {
+  return std::move(this->cmd_line);
+};
+
+std::string Command::takeOldCmdLine() {
+  return std::move(this->org_cmd_line);
+};
+
+// Commands come and go with every line, so they are recycled by size class
+void* Command::operator new(size_t size) {
+  return poolAlloc(size);
+};
+
+void Command::operator delete(void* mem, size_t size) {
+  poolFree(mem, size);
+};
+
+CommandKind Command::getKind() {
+  return this->kind;
 };
 /*** Command class END ***/
 
@@ -536,43 +1059,45 @@ const char* Command::getOldCmdLine() {
 
 
 /*** BuiltInCommand class ***/
-BuiltInCommand::BuiltInCommand(const char* cmd_line_t) : Command(cmd_line_t) {
+BuiltInCommand::BuiltInCommand(const CommandLine& line) : Command(line, CMD_BUILTIN),
+    in_fd(STDIN_FILENO), out_fd(STDOUT_FILENO), err_fd(STDERR_FILENO) {
   isBgCmd = false;
 };
+
+void BuiltInCommand::setFds(int in_fd, int out_fd, int err_fd) {
+  this->in_fd = in_fd;
+  this->out_fd = out_fd;
+  this->err_fd = err_fd;
+};
 /*** BuiltInCommand class END ***/
 
 
 
 
 /*** ExternalCommand class ***/
-ExternalCommand::ExternalCommand(const char* cmd_line) : Command(cmd_line) {};
+ExternalCommand::ExternalCommand(const CommandLine& line) : Command(line, CMD_EXTERNAL) {};
 
 void ExternalCommand::execute() {
     SmallShell& smash = SmallShell::getInstance();
-    pid_t pid = fork();
-    if (pid == 0) {
-      setpgrp();
-
-      char cmd_line_t[PATH_MAX];
-      strcpy(cmd_line_t, getCmdLine());
-      char bash_path[PATH_MAX];
-      strcpy(bash_path, BASH_PATH);
-      char bash_arg[10];
-      strcpy(bash_arg, "-c");
-      char* args[] = {bash_path, bash_arg, cmd_line_t, NULL};
-      if (execv(BASH_PATH, args) == -1) {
-        _PRINT_PERROR(SYSCALL_ERROR, EXECV)
-      }
-      exit(0);
-    } 
+    SpawnSpec spec;
+    Redirector redir;
+    if (!_prepareSpawn(spec, redir, line.commands[0], getCmdLine(), args, argc)) {
+      return;
+    }
+    redir.addTo(spec);
+    int pidfd;
+    pid_t pid = smash.launcher.spawn(spec, &pidfd);
+    if (pid == -1) {
+      return;
+    }
     else {
-      smash.jl.addJob(this, false, pid);
+      smash.jl.addJob(*this, false, pid, pidfd);
       int job_id = smash.jl.getHighestJobID();
       if (!getIsBgCmd()) {
         smash.curr_job = smash.jl.getJobById(job_id);
-        int status;
-        waitpid(pid, &status, WUNTRACED);
+        int status = smash.waitJob(pid);
         if (!WIFSTOPPED(status)) {
+          smash.reportUsage(job_id);
           smash.jl.removeJobById(job_id);
           smash.curr_job = nullptr;
         }
@@ -585,111 +1110,224 @@ void ExternalCommand::execute() {
 
 
 
-/*** RedirectionCommand class ***/
-RedirectionCommand::RedirectionCommand(const char* cmd_line, JobsList* jl) : Command(cmd_line), jl(jl) {
-  this->isAppend = (string(cmd_line).find(">>") != std::string::npos);
-  this->cmd = string(cmd_line).substr(0, string(cmd_line).find(">"));
-  this->file = _trim(string(cmd_line).substr(string(cmd_line).find_last_of(">") + 1));
-};
-
-void RedirectionCommand::execute() {
-  const char* c_cmd = cmd.c_str();
-  const char* c_file = file.c_str();
-  int old_out = dup(1);
-  if(old_out == -1) {
-    _PRINT_PERROR(SYSCALL_ERROR, DUP)
-    return;
+// A builtin that only writes output (BUILTIN_PIPELINE), so it never needs its own process
+static bool _isPipelineBuiltin(const SimpleCommand& simple) {
+  if (simple.argc == 0) {
+    return false;
   }
+  const BuiltinEntry* builtin = SmallShell::findBuiltin(simple.argv[0]);
+  return builtin != nullptr && (builtin->flags & BUILTIN_PIPELINE);
+}
 
-  int new_out;
-  if (isAppend) {
-    new_out = open(c_file, O_CREAT | O_APPEND | O_WRONLY, 0666);
-  }
-  else {
-    new_out = open(c_file, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-  }
+// Runs cmd with std::cout, and std::cerr too if with_err, going into a string
+static string _captureOutput(Command& cmd, bool with_err) {
+  std::stringbuf captured;
+  std::streambuf* old_out = std::cout.rdbuf(&captured);
+  std::streambuf* old_err = with_err ? std::cerr.rdbuf(&captured) : nullptr;
+  cmd.execute();
+  std::cout.rdbuf(old_out);
+  if (with_err) {
+    std::cerr.rdbuf(old_err);
+  }
+  return captured.str();
+}
 
-  if (new_out == -1) {
-    _PRINT_PERROR(SYSCALL_ERROR, OPEN)
-    close(old_out);
+
+
+/*** RedirectionCommand class ***/
+RedirectionCommand::RedirectionCommand(const CommandLine& line, unsigned flags) :
+    Command(line, CMD_REDIRECTION), flags(flags), inner(line), bare(line.commands[0]) {
+  this->bare.redir_count = 0;
+  this->inner.commands = &this->bare;
+};
+
+/**
+* A builtin that stays in smash: std::cout and std::cerr are pointed at its
+* redirected fds, and one that moves bytes itself or spawns, like cat or
+* parallel, is handed the fds its 0, 1 and 2 resolve to. "> file" alone just
+* creates the file.
+*/
+void RedirectionCommand::execute() {
+  Redirector redir;
+  if (!redir.open(line.commands[0])) {
+    _FAIL
     return;
   }
-  if (dup2(new_out,1) == -1) {
-    _PRINT_PERROR(SYSCALL_ERROR, DUP)
+  if (bare.argc == 0) {
     return;
   }
-  if (close(new_out) == -1) {
-    _PRINT_PERROR(SYSCALL_ERROR, CLOSE)
-    return;
-  } 
-  SmallShell& smash = SmallShell::getInstance();
-  smash.executeCommand(c_cmd);
-
-  if (dup2(old_out, 1) == -1) {
-    _PRINT_PERROR(SYSCALL_ERROR, DUP)
-    return;
+  int out_fd = redir.resolve(STDOUT_FILENO);
+  int err_fd = redir.resolve(STDERR_FILENO);
+  OutBuf out_file(out_fd);
+  OutBuf err_file(err_fd);
+  std::streambuf* old_out = std::cout.rdbuf();
+  std::streambuf* old_err = std::cerr.rdbuf();
+  // smash's own fds keep smash's buffers, and two streams on one file share one
+  std::streambuf* new_out = (out_fd == STDOUT_FILENO) ? old_out : (out_fd == STDERR_FILENO) ? old_err : &out_file;
+  std::streambuf* new_err = (err_fd == STDERR_FILENO) ? old_err : (err_fd == STDOUT_FILENO) ? old_out :
+                            (err_fd == out_fd) ? new_out : &err_file;
+  std::cout.rdbuf(new_out);
+  std::cerr.rdbuf(new_err);
+  std::unique_ptr<Command> cmd = SmallShell::getInstance().CreateCommand(inner);
+  int out_flags = -1;
+  if (flags & BUILTIN_RAW_FDS) {
+    static_cast<BuiltInCommand*>(cmd.get())->setFds(redir.resolve(STDIN_FILENO), out_fd, err_fd);
+    // the in-kernel copies refuse O_APPEND, so a ">>" file nobody else has open is written at its end instead
+    out_flags = redir.owns(out_fd) ? fcntl(out_fd, F_GETFL) : -1;
+    if (out_flags == -1 || !(out_flags & O_APPEND) || lseek(out_fd, 0, SEEK_END) == -1 ||
+        fcntl(out_fd, F_SETFL, out_flags & ~O_APPEND) == -1) {
+      out_flags = -1;
+    }
   }
-  if (close(old_out) == -1) {
-    _PRINT_PERROR(SYSCALL_ERROR, CLOSE)
-    return;
-  }    
+  cmd->execute();
+  if (out_flags != -1) {
+    fcntl(out_fd, F_SETFL, out_flags);
+  }
+  std::cout.rdbuf(old_out);
+  std::cerr.rdbuf(old_err);
+  out_file.flush();
+  err_file.flush();
 };
 /*** RedirectionCommand class END ***/
 
 
 
 /*** PipeCommand class ***/
-PipeCommand::PipeCommand(const char* cmd_line) : Command(cmd_line) {
-  this->isStderr = (string(cmd_line).find("|&") != std::string::npos);
-  this->cmd1 = string(cmd_line).substr(0, string(cmd_line).find("|"));
-  this->cmd2 = string(cmd_line).substr(string(cmd_line).find("|") + (!this->isStderr ? 1 : 2));
-};
+PipeCommand::PipeCommand(const CommandLine& line) : Command(line, CMD_PIPE) {};
 
-void PipeCommand::execute() {
-  int pipe_args[2];
-  if(pipe(pipe_args) != 0 ) {
-    _PRINT_PERROR(SYSCALL_ERROR, PIPE)
-    return;
+/**
+* Starts one stage with in_fd/out_fd (-1 for none) as its stdin and stdout or stderr.
+* External commands are exec'd directly. An output-only builtin feeding a pipe runs
+* right here and its output is handed to the event loop, which writes it as the
+* next stage reads: it returns 0, as there is no process. Any other builtin gets
+* a forked smash.
+*/
+pid_t PipeCommand::launchStage(int stage, int in_fd, int out_fd, pid_t pgid, const std::vector<int>& pipe_fds) {
+  SmallShell& smash = SmallShell::getInstance();
+  const SimpleCommand& simple = line.commands[stage];
+  int out_target = simple.pipe_stderr ? STDERR_FILENO : STDOUT_FILENO;
+  CommandLine stage_line = line.stage(stage);
+  std::unique_ptr<Command> cmd = smash.CreateCommand(stage_line);
+  pid_t pid;
+  if (out_fd != -1 && _isPipelineBuiltin(simple) && simple.redir_count == 0) {
+    int feed_fd = fcntl(out_fd, F_DUPFD_CLOEXEC, 0);
+    if (feed_fd == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, DUP)
+      return -1;
+    }
+    smash.events.feed(feed_fd, _captureOutput(*cmd, simple.pipe_stderr));
+    return 0;
+  }
+  if (cmd->getKind() == CMD_EXTERNAL) {
+    SpawnSpec spec;
+    Redirector redir;
+    if (!_prepareSpawn(spec, redir, simple, cmd->getCmdLine(), simple.argv, simple.argc)) {
+      return -1;
+    }
+    spec.pgid = pgid;
+    // the pipes are O_CLOEXEC, so only these copies survive the exec
+    if (in_fd != -1) {
+      spec.addDup(in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1) {
+      spec.addDup(out_fd, out_target);
+    }
+    redir.addTo(spec);
+    return smash.launcher.spawn(spec);
   }
-  int pid = fork();
+  cmd.reset();
+  pid = smash.launcher.forkShell(pgid);
   if (pid == 0) {
-    (this->isSon) = true;
-    setpgrp();
-    close(pipe_args[0]);
-    if (dup2(pipe_args[1], (this->isStderr ? 2 : 1)) == -1) {
+    smash.becomeChild();
+    if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) || (out_fd != -1 && dup2(out_fd, out_target) == -1)) {
       _PRINT_PERROR(SYSCALL_ERROR, DUP)
-      exit(0);
+      exit(1);
     }
-    SmallShell& smash = SmallShell::getInstance();
-    smash.executeCommand(cmd1.c_str());
-    if (close(pipe_args[1]) == -1) {
-      _PRINT_PERROR(SYSCALL_ERROR, CLOSE)
-      exit(0);
+    for (int fd : pipe_fds) {
+      close(fd);
     }
-    exit(0);
-  }
-  else {
-    (this->isSon) = false;
-    close(pipe_args[1]);
-    int old_out = dup(0);
-    if (old_out == -1) {
+    // the stage's redirections go on top of the pipes, and the line runs without them
+    Redirector redir;
+    if (!redir.open(simple)) {
+      exit(1);
+    }
+    if (!redir.apply()) {
       _PRINT_PERROR(SYSCALL_ERROR, DUP)
+      exit(1);
+    }
+    SimpleCommand bare = simple;
+    bare.redir_count = 0;
+    stage_line.commands = &bare;
+    smash.executeLine(stage_line);
+    exit(smash.getStatus());
+  }
+  return pid;
+}
+
+/**
+* Creates every pipe first, then starts all stages into one process group led by
+* the first stage that is a process. The whole pipeline is a single job, waited
+* on stage by stage.
+*/
+void PipeCommand::execute() {
+  int stages = line.count;
+  for (int i = 0; i < stages; i++) {
+    if (line.commands[i].argc == 0) {
+      _PRINT_ERROR(INVALID_ARGS_ERROR, PIPE)
       return;
     }
-    if (dup2(pipe_args[0], 0) == -1) {
-      _PRINT_PERROR(SYSCALL_ERROR, DUP)
+  }
+  std::vector<int> pipe_fds;
+  for (int i = 0; i + 1 < stages; i++) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      _PRINT_PERROR(SYSCALL_ERROR, PIPE)
+      for (int fd : pipe_fds) {
+        close(fd);
+      }
       return;
     }
-    SmallShell& smash = SmallShell::getInstance();
-    smash.executeCommand(cmd2.c_str());
-    if (close(pipe_args[0]) == -1) {
+    pipe_fds.push_back(fds[0]);
+    pipe_fds.push_back(fds[1]);
+  }
+
+  // stages that finish early stay unreaped until the job knows about them: smash
+  // only reaps when it waits or starts the next line
+  SmallShell& smash = SmallShell::getInstance();
+  std::vector<pid_t> pids;
+  for (int i = 0; i < stages; i++) {
+    int in_fd = (i > 0) ? pipe_fds[2 * (i - 1)] : -1;
+    int out_fd = (i + 1 < stages) ? pipe_fds[2 * i + 1] : -1;
+    pid_t pid = launchStage(i, in_fd, out_fd, pids.empty() ? 0 : pids[0], pipe_fds);
+    if (pid == -1) {
+      break;
+    }
+    if (pid != 0) {
+      pids.push_back(pid);
+    }
+  }
+  for (int fd : pipe_fds) {
+    if (close(fd) == -1) {
       _PRINT_PERROR(SYSCALL_ERROR, CLOSE)
     }
-    if (dup2(old_out, 0) == -1) {
-      _PRINT_PERROR(SYSCALL_ERROR, DUP)
-      return;
+  }
+  if (pids.empty()) {
+    return;
+  }
+  smash.jl.addJob(*this, false, pids[0]);
+  int job_id = smash.jl.getHighestJobID();
+  for (size_t i = 1; i < pids.size(); i++) {
+    smash.jl.addJobProcess(job_id, pids[i]);
+  }
+
+  if (!getIsBgCmd()) {
+    smash.curr_job = smash.jl.getJobById(job_id);
+    int status = smash.waitPids(pids);
+    if (!WIFSTOPPED(status)) {
+      smash.reportUsage(job_id);
+      smash.jl.removeJobById(job_id);
+      smash.curr_job = nullptr;
     }
-    close(old_out);
   }
 };
 /*** PipeCommand class END ***/
@@ -699,8 +1337,8 @@ void PipeCommand::execute() {
 
 
 /*** ChangeDirCommand class ***/
-ChangeDirCommand::ChangeDirCommand(const char* cmd_line, char** plastPwd, bool* pwd_exist) :
-   BuiltInCommand(cmd_line), oldpwd(plastPwd), pwd_exist(pwd_exist) {};
+ChangeDirCommand::ChangeDirCommand(const CommandLine& line, char** plastPwd, bool* pwd_exist) :
+   BuiltInCommand(line), oldpwd(plastPwd), pwd_exist(pwd_exist) {};
 
 void ChangeDirCommand::execute() {
   if (argc == 1) {
@@ -740,11 +1378,11 @@ void ChangeDirCommand::execute() {
 
 
 /*** GetCurrDirCommand class ***/
-GetCurrDirCommand::GetCurrDirCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {};
+GetCurrDirCommand::GetCurrDirCommand(const CommandLine& line) : BuiltInCommand(line) {};
 
 void GetCurrDirCommand::execute() {
   char cwd[PATH_MAX];
-  std::cout << std::string(getcwd(cwd, sizeof(cwd))) << std::endl; 
+  std::cout << std::string(getcwd(cwd, sizeof(cwd))) << '\n'; 
 };
 /*** GetCurrDirCommand class END ***/
 
@@ -752,11 +1390,11 @@ void GetCurrDirCommand::execute() {
 
 
 /*** ShowPidCommand class ***/
-ShowPidCommand::ShowPidCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {};
+ShowPidCommand::ShowPidCommand(const CommandLine& line) : BuiltInCommand(line) {};
 
 void ShowPidCommand::execute() {
   SmallShell& smash = SmallShell::getInstance();
-  std::cout << "smash pid is " << smash.get_pid() << std::endl; 
+  std::cout << "smash pid is " << smash.get_pid() << '\n'; 
 };
 /*** ShowPidCommand class END ***/
 
@@ -764,14 +1402,14 @@ void ShowPidCommand::execute() {
 
 
 /*** ChangePromptCommand class ***/
-ChangePromptCommand::ChangePromptCommand(const char* cmd_line, char** curr_prompt) : BuiltInCommand(cmd_line), prompt_ptr(curr_prompt) {};
+ChangePromptCommand::ChangePromptCommand(const CommandLine& line, std::string* curr_prompt) : BuiltInCommand(line), prompt_ptr(curr_prompt) {};
 
 void ChangePromptCommand::execute() {
   if (argc > 1) {
-    strcpy(*prompt_ptr, string(args[1]).c_str());
+    *prompt_ptr = args[1];
   }
   else {
-    strcpy(*prompt_ptr, string(DEFAULT_PROMPT).c_str());
+    *prompt_ptr = DEFAULT_PROMPT;
   }
 };
 /*** ChangePromptCommand class END ***/
@@ -780,10 +1418,14 @@ void ChangePromptCommand::execute() {
 
 
 /*** JobsCommand class ***/
-JobsCommand::JobsCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+JobsCommand::JobsCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
 
+/**
+* jobs [-v]
+* -v adds each job's wall time and resource usage under it. Other arguments are ignored.
+*/
 void JobsCommand::execute() {
-  jobs->printJobsList();
+  jobs->printJobsList(argc > 1 && strcmp(args[1], "-v") == 0);
 };
 /*** JobsCommand class END ***/
 
@@ -791,7 +1433,7 @@ void JobsCommand::execute() {
 
 
 /*** KillCommand class ***/
-KillCommand::KillCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+KillCommand::KillCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
 
 void KillCommand::execute() {
   if (argc != 3) {
@@ -821,11 +1463,11 @@ void KillCommand::execute() {
     }
 
     pid_t job_pid = je->getJobPid();
-    if (kill(job_pid, sig_num) != 0){
+    if (je->signalJob(sig_num) != 0){
       _PRINT_PERROR(SYSCALL_ERROR, KILL)
       return;
     }
-    fprintf(stdout, "signal number %d was sent to pid %d\n", sig_num, job_pid);
+    std::cout << "signal number " << sig_num << " was sent to pid " << job_pid << '\n';
   }
   else {
       _PRINT_ERROR(INVALID_ARGS_ERROR, KILL)
@@ -837,7 +1479,7 @@ void KillCommand::execute() {
 
 
 /*** ForegroundCommand class ***/
-ForegroundCommand::ForegroundCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+ForegroundCommand::ForegroundCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
 
 void ForegroundCommand::execute() {
   if (argc > 2) {
@@ -860,18 +1502,17 @@ void ForegroundCommand::execute() {
   }
 
 
-  pid_t pid = je->getJobPid();
-  std::cout << je->getOldCmdLine() << " : " << je->getJobPid() << std::endl;
-  if (kill(je->getJobPid(), SIGCONT) != 0) {
+  std::cout << je->getOldCmdLine() << " : " << je->getJobPid() << '\n';
+  if (je->signalJob(SIGCONT) != 0) {
     _PRINT_PERROR(SYSCALL_ERROR, FG)
     return;
   }
-  int status;
   SmallShell& smash = SmallShell::getInstance();
   smash.curr_job = je;
-  waitpid(pid, &status, WUNTRACED);
+  int status = smash.waitPids(std::vector<pid_t>(je->getRunningPids()));
   if (!WIFSTOPPED(status)) {
-    jobs->removeJobById(job_id, false);
+    smash.reportUsage(job_id);
+    jobs->removeJobById(job_id);
     smash.curr_job = nullptr;
     return;
   }
@@ -883,7 +1524,7 @@ void ForegroundCommand::execute() {
 
 
 /*** BackgroundCommand class ***/
-BackgroundCommand::BackgroundCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+BackgroundCommand::BackgroundCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
 
 void BackgroundCommand::execute() {
   if (argc > 2) {
@@ -912,12 +1553,12 @@ void BackgroundCommand::execute() {
     return;
 
   }
-  if (kill(je->getJobPid(), SIGCONT) != 0) {
+  if (je->signalJob(SIGCONT) != 0) {
     _PRINT_PERROR(SYSCALL_ERROR, BG)
     return;
   }
   je->setStopped(false);
-  std::cout << je->getOldCmdLine() << " : " << je->getJobPid() << std::endl;
+  std::cout << je->getOldCmdLine() << " : " << je->getJobPid() << '\n';
 };
 /*** BackgroundCommand class END ***/
 
@@ -925,65 +1566,75 @@ void BackgroundCommand::execute() {
 
 
 /*** QuitCommand class ***/
-QuitCommand::QuitCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+QuitCommand::QuitCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
 
 void QuitCommand::execute() {
   if ((argc > 1 && strcmp(args[1], "kill") == 0)) {  
-    std::cout << "smash: sending SIGKILL signal to " << jobs->size() << " jobs:" << std::endl;
+    std::cout << "smash: sending SIGKILL signal to " << jobs->size() << " jobs:" << '\n';
     jobs->printKillJobs();
     jobs->killAllJobs();
   }
+  exit(0);
 };
 /*** QuitCommand class END ***/
 
 
 
 /*** TimeoutCommand class ***/
-TimeoutCommand::TimeoutCommand(const char* cmd_line) : Command(cmd_line){}
+TimeoutCommand::TimeoutCommand(const CommandLine& line) : Command(line, CMD_TIMEOUT){}
 
 void TimeoutCommand::execute() {
   SmallShell& smash = SmallShell::getInstance();
-  if(argc <= 2) {
+  int sig = SIGKILL;
+  long long grace = -1;
+  int arg = 1;
+  while (arg + 1 < argc && (strcmp(args[arg], "-s") == 0 || strcmp(args[arg], "-k") == 0)) {
+    if (args[arg][1] == 's') {
+      sig = _parseSignal(args[arg + 1]);
+    }
+    else {
+      grace = TimerQueue::parseDuration(args[arg + 1]);
+    }
+    if (sig == -1 || (args[arg][1] == 'k' && grace < 0)) {
+      _PRINT_ERROR(INVALID_ARGS_ERROR, TIMEOUT)
+      return;
+    }
+    arg += 2;
+  }
+  if(argc <= arg + 1) {
     _PRINT_ERROR(INVALID_ARGS_ERROR, TIMEOUT)
     return;
   }
-  int secs = argToInt(args[1]);
-  string str_cmd = string(cmd_line);
-  string str_cmd_temp = str_cmd.substr(str_cmd.find_first_of(" ") + 1);
-  string new_cmd = str_cmd_temp.substr(str_cmd_temp.find_first_of(" ") + 1);
+  long long duration = TimerQueue::parseDuration(args[arg]);
+  string new_cmd = _skipWords(string(cmd_line), arg + 1);
   
-  if(secs < 0) {
+  if(duration < 0) {
     _PRINT_ERROR(INVALID_ARGS_ERROR, TIMEOUT)
     return;
   }
-  pid_t pid = fork();
-  if (pid == 0) {
-    setpgrp();
-    char cmd_line_t[PATH_MAX];
-    strcpy(cmd_line_t, new_cmd.c_str());
-    char bash_path[PATH_MAX];
-    strcpy(bash_path, BASH_PATH);
-    char bash_arg[10];
-    strcpy(bash_arg, "-c");
-    char* args[] = {bash_path, bash_arg, cmd_line_t, NULL};
-    if (execv(BASH_PATH, args) == -1) {
-      _PRINT_PERROR(SYSCALL_ERROR, EXECV)
-    }
-    exit(0);
-  } 
+  SpawnSpec spec;
+  Redirector redir;
+  if (!_prepareSpawn(spec, redir, line.commands[0], new_cmd.c_str(), args + arg + 1, argc - arg - 1)) {
+    return;
+  }
+  redir.addTo(spec);
+  int pidfd;
+  pid_t pid = smash.launcher.spawn(spec, &pidfd);
+  if (pid == -1) {
+    return;
+  }
   else {
-    smash.timeoutlist.addJob(this, false, pid);
-    smash.jl.addJob(this, false, pid);
-    smash.timeoutlist.sortTimeout();
-    smash.timeoutlist.setAlarm();
+    smash.jl.addJob(*this, false, pid, pidfd);
+    smash.timers.add(pid, duration, sig, (sig == SIGKILL) ? -1 : grace);
+    smash.timers.arm();
     int job_id = smash.jl.getHighestJobID();
     if (!getIsBgCmd()) {
       smash.curr_job = smash.jl.getJobById(job_id);
-      int status;
-      waitpid(pid, &status, WUNTRACED);
+      int status = smash.waitJob(pid);
       if (!WIFSTOPPED(status)) {
-        smash.jl.removeJobById(job_id, false);
-        smash.timeoutlist.removeJobById(job_id);
+        smash.reportUsage(job_id);
+        smash.jl.removeJobById(job_id);
+        smash.timers.cancel(pid);
         smash.curr_job = nullptr;
       }
     }
@@ -993,32 +1644,975 @@ void TimeoutCommand::execute() {
 
 
 /*** HeadCommand class ***/
-HeadCommand::HeadCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+HeadCommand::HeadCommand(const CommandLine& line) : BuiltInCommand(line) {}
 
+/**
+* head [-N | -n N | -c BYTES] [FILE | -]
+* Reads 64 KiB blocks and writes everything up to the N-th newline (found with
+* memchr, which glibc vectorizes) straight to stdout in as few writes as possible.
+* Byte counts never need to look at the data, so -c is spliced between the fds.
+* Without a file operand, or with "-", it reads stdin.
+*/
 void HeadCommand::execute() {
-  if (argc != 2 && argc != 3)  {
-    _PRINT_ERROR(NOT_ENOUGH_ARGS_ERROR, HEAD)
+  long long count = 10;
+  bool bytes = false;
+  const char* file = nullptr;
+  for (int i = 1; i < argc && count >= 0; i++) {
+    if ((strcmp(args[i], "-c") == 0 || strcmp(args[i], "-n") == 0) && i + 1 < argc) {
+      bytes = (args[i][1] == 'c');
+      count = _parseCount(args[++i]);
+    }
+    else if (args[i][0] == '-' && args[i][1] != '\0' && file == nullptr) {
+      count = _parseCount(args[i] + 1);
+    }
+    else if (file == nullptr) {
+      file = args[i];
+    }
+    else {
+      _PRINT_ERROR(TOO_MANY_ARGS_ERROR, HEAD)
+      return;
+    }
+  }
+  if (count < 0) {
+    _PRINT_ERROR(INVALID_ARGS_ERROR, HEAD)
     return;
   }
-  int lines = (argc == 3) ? argToInt(args[1] + 1) : 10;
-  char* file = (argc == 3) ? args[2] : args[1];
-  int fd = open(file, O_RDONLY);
+  bool use_stdin = (file == nullptr || strcmp(file, "-") == 0);
+  int fd = use_stdin ? in_fd : open(file, O_RDONLY | O_CLOEXEC);
   if (fd == -1) {
     _PRINT_PERROR(SYSCALL_ERROR, OPEN)
     return;
   }
-  
-  char curr_char[1];
-  int status;
-  while((status = read(fd, curr_char, 1)) > 0 && lines > 0) {
-    std::cout << curr_char;
-    if(strcmp(curr_char, "\n") == 0) {
-        lines--;
+  std::cout.flush();
+
+  if (bytes) {
+    if (count > 0 && _copyFd(fd, out_fd, count) == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, SPLICE)
+    }
+    if (!use_stdin) {
+      close(fd);
+    }
+    return;
+  }
+  char* buf = io_buffer;
+  ssize_t status = 0;
+  while (count > 0 && (status = read(fd, buf, sizeof(io_buffer))) > 0) {
+    size_t len = status;
+    const char* pos = buf;
+    const char* end = buf + status;
+    while (count > 0 && (pos = (const char*)memchr(pos, '\n', end - pos)) != nullptr) {
+      pos++;
+      count--;
     }
-  } 
+    if (count == 0) {
+      len = pos - buf;
+    }
+    if (!_writeAll(out_fd, buf, len)) {
+      _PRINT_PERROR(SYSCALL_ERROR, WRITE)
+      break;
+    }
+    // leave a seekable stdin right after what we consumed, like coreutils head
+    if (use_stdin && len < (size_t)status) {
+      lseek(fd, (off_t)len - status, SEEK_CUR);
+    }
+  }
 
   if(status == -1) {
     _PRINT_PERROR(SYSCALL_ERROR, READ)
   }
+  if (!use_stdin) {
+    close(fd);
+  }
 };
 /*** HeadCommand class END ***/
+
+
+
+/*** CatCommand class ***/
+CatCommand::CatCommand(const CommandLine& line) : BuiltInCommand(line) {}
+
+/**
+* For a tty, pipe or FIFO read by smash itself: moves whatever each read brings,
+* sleeping in the event loop in between, until EOF or ctrl-C. -1 on an error.
+*/
+static long long _relayInput(int in_fd, int out_fd) {
+  long long total = 0;
+  while (_awaitInput(in_fd)) {
+    ssize_t len = read(in_fd, io_buffer, sizeof(io_buffer));
+    if (len == -1) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return -1;
+    }
+    if (len == 0) {
+      break;
+    }
+    if (!_writeAll(out_fd, io_buffer, len)) {
+      return -1;
+    }
+    total += len;
+  }
+  return total;
+}
+
+/**
+* cat [FILE | -]...
+* Copies each FILE, or stdin for "-" or no operand, to stdout inside the kernel
+* where it can (see _copyFd), CAT_CHUNK_SIZE at a time so ctrl-C is noticed in
+* between. "cat a b >> out" runs in smash on the redirected fd, without a fork.
+* A tty or pipe is read through _relayInput instead. With any option the
+* system's cat runs (see _catHandles).
+*/
+void CatCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  struct stat out_st;
+  bool out_regular = (fstat(out_fd, &out_st) == 0 && S_ISREG(out_st.st_mode));
+
+  smash.interrupted = 0;
+  for (int i = (argc > 1) ? 1 : 0; i < argc && smash.interrupted == 0; i++) {
+    bool use_stdin = (i == 0 || strcmp(args[i], "-") == 0);
+    int fd = use_stdin ? in_fd : open(args[i], O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, OPEN)
+      continue;
+    }
+    // what smash printed so far, errors included, goes before the bytes written to the fd directly
+    std::cout.flush();
+    std::cerr.flush();
+    struct stat in_st;
+    bool in_regular = (fstat(fd, &in_st) == 0 && S_ISREG(in_st.st_mode));
+    if (out_regular && in_regular && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino &&
+        in_st.st_size > 0) {
+      _PRINT_ERROR(SAME_FILE_ERROR, CAT)
+    }
+    else if (!in_regular && getpid() == smash.get_pid()) {
+      if (_relayInput(fd, out_fd) == -1) {
+        _PRINT_PERROR(SYSCALL_ERROR, COPY)
+      }
+    }
+    else {
+      long long moved;
+      while ((moved = _copyFd(fd, out_fd, CAT_CHUNK_SIZE)) > 0) {
+        smash.events.poll();
+        if (smash.interrupted != 0) {
+          break;
+        }
+      }
+      if (moved == -1) {
+        _PRINT_PERROR(SYSCALL_ERROR, COPY)
+      }
+    }
+    if (!use_stdin) {
+      smash.events.release(fd);
+      close(fd);
+    }
+  }
+
+  if (smash.interrupted != 0) {
+    smash.setStatus(128 + smash.interrupted);
+    smash.interrupted = 0;
+  }
+};
+/*** CatCommand class END ***/
+
+
+
+/*** TailCommand class ***/
+TailCommand::TailCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {
+  // tail -f & follows in the background
+  isBgCmd = line.background;
+}
+
+/**
+* Scans buf backwards (memrchr, which glibc vectorizes) for the count-th newline
+* and returns where the line after it starts. Without that many, returns -1 with
+* count lowered by the newlines it passed.
+*/
+static ssize_t _scanLines(const char* buf, size_t len, long long& count) {
+  const char* nl;
+  while ((nl = (const char*)memrchr(buf, '\n', len)) != nullptr) {
+    if (--count == 0) {
+      return nl - buf + 1;
+    }
+    len = nl - buf;
+  }
+  return -1;
+}
+
+// Where the last count lines of the regular file fd start, reading blocks backwards from its end
+static off_t _tailStart(int fd, off_t size, long long count) {
+  off_t end = size;
+  while (end > 0 && count > 0) {
+    off_t start = (end > IO_BUFFER_SIZE) ? end - IO_BUFFER_SIZE : 0;
+    ssize_t len = pread(fd, io_buffer, end - start, start);
+    if (len != end - start) {
+      return -1;
+    }
+    // the newline that ends the file ends the last line; it starts none
+    if (end == size && io_buffer[len - 1] == '\n') {
+      len--;
+    }
+    ssize_t found = _scanLines(io_buffer, len, count);
+    if (found != -1) {
+      return start + found;
+    }
+    end = start;
+  }
+  return (count == 0) ? size : 0;
+}
+
+// For pipes and terminals: reads to EOF, keeping only enough of the end in memory
+static bool _tailStream(int in_fd, int out_fd, long long count, bool bytes) {
+  string kept;
+  size_t limit = TAIL_KEEP_SIZE;
+  ssize_t len;
+  while (_awaitInput(in_fd) && (len = read(in_fd, io_buffer, sizeof(io_buffer))) != 0) {
+    if (len == -1) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return false;
+    }
+    kept.append(io_buffer, len);
+    if (kept.size() < limit) {
+      continue;
+    }
+    if (bytes) {
+      kept.erase(0, kept.size() - min((size_t)count, kept.size()));
+    }
+    else {
+      long long need = count;
+      ssize_t start = (count == 0) ? kept.size() : _scanLines(kept.data(), kept.size() - 1, need);
+      kept.erase(0, (start == -1) ? 0 : start);
+    }
+    limit = max((size_t)TAIL_KEEP_SIZE, 2 * kept.size());
+  }
+  // ctrl-C: like the tail it stands in for, nothing is printed
+  if (SmallShell::getInstance().interrupted != 0) {
+    return true;
+  }
+  size_t start = 0;
+  if (bytes) {
+    start = kept.size() - min((size_t)count, kept.size());
+  }
+  else if (count == 0) {
+    start = kept.size();
+  }
+  else if (!kept.empty()) {
+    long long need = count;
+    size_t scan = kept.size() - ((kept.back() == '\n') ? 1 : 0);
+    ssize_t found = _scanLines(kept.data(), scan, need);
+    start = (found == -1) ? 0 : found;
+  }
+  return _writeAll(out_fd, kept.data() + start, kept.size() - start);
+}
+
+/**
+* tail -f: copies whatever is appended to the file, sleeping on inotify in between.
+* A truncated file is followed from its new start. Returns only if it fails.
+*/
+static void _tailFollow(int notify_fd, int fd, int out_fd) {
+  alignas(struct inotify_event) char events[TAIL_EVENTS_SIZE];
+  while (true) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size < lseek(fd, 0, SEEK_CUR)) {
+      lseek(fd, 0, SEEK_SET);
+    }
+    if (_copyFd(fd, out_fd, -1) == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, COPY)
+      return;
+    }
+    if (read(notify_fd, events, sizeof(events)) == -1 && errno != EINTR) {
+      _PRINT_PERROR(SYSCALL_ERROR, INOTIFY)
+      return;
+    }
+  }
+}
+
+// Prints the last count lines, or bytes, of fd; a regular file is never read from the front
+static void _tailPrint(int fd, int out_fd, long long count, bool bytes) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    if (!_tailStream(fd, out_fd, count, bytes)) {
+      _PRINT_PERROR(SYSCALL_ERROR, READ)
+    }
+    return;
+  }
+  off_t start = bytes ? ((st.st_size > count) ? st.st_size - count : 0) : _tailStart(fd, st.st_size, count);
+  if (start == -1 || lseek(fd, start, SEEK_SET) == -1) {
+    _PRINT_PERROR(SYSCALL_ERROR, READ)
+    return;
+  }
+  if (_copyFd(fd, out_fd, -1) == -1) {
+    _PRINT_PERROR(SYSCALL_ERROR, COPY)
+  }
+}
+
+/**
+* tail [-N | -n N | -c BYTES] [-f] [FILE | -]
+* Prints the last N lines (default 10) or BYTES bytes. A regular file is read in
+* blocks backwards from its end, so only what gets printed is ever scanned, and
+* the rest is copied in the kernel. With -f on a regular file it keeps printing
+* what is appended, woken by inotify: that runs as a job of its own, which jobs,
+* kill and fg control like any other. Other options run the system's tail (see
+* _tailHandles).
+*/
+void TailCommand::execute() {
+  long long count = 10;
+  bool bytes = false;
+  bool follow = false;
+  const char* file = nullptr;
+  for (int i = 1; i < argc && count >= 0; i++) {
+    if ((strcmp(args[i], "-c") == 0 || strcmp(args[i], "-n") == 0) && i + 1 < argc) {
+      bytes = (args[i][1] == 'c');
+      count = _parseCount(args[++i]);
+    }
+    else if (strcmp(args[i], "-f") == 0) {
+      follow = true;
+    }
+    else if (args[i][0] == '-' && args[i][1] != '\0' && file == nullptr) {
+      count = _parseCount(args[i] + 1);
+    }
+    else if (file == nullptr) {
+      file = args[i];
+    }
+    else {
+      _PRINT_ERROR(TOO_MANY_ARGS_ERROR, TAIL)
+      return;
+    }
+  }
+  if (count < 0) {
+    _PRINT_ERROR(INVALID_ARGS_ERROR, TAIL)
+    return;
+  }
+  bool use_stdin = (file == nullptr || strcmp(file, "-") == 0);
+  int fd = use_stdin ? in_fd : open(file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    _PRINT_PERROR(SYSCALL_ERROR, OPEN)
+    return;
+  }
+  struct stat st;
+  follow = follow && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  // watched before anything is printed, so no write in between goes unnoticed
+  int notify_fd = -1;
+  if (follow) {
+    string path = use_stdin ? "/proc/self/fd/" + to_string(fd) : file;
+    notify_fd = inotify_init1(IN_CLOEXEC);
+    if (notify_fd == -1 || inotify_add_watch(notify_fd, path.c_str(), IN_MODIFY | IN_ATTRIB) == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, INOTIFY)
+      follow = false;
+    }
+  }
+  SmallShell& smash = SmallShell::getInstance();
+  smash.interrupted = 0;
+  // a forked smash, e.g. a pipeline stage, is already the job; smash itself starts one
+  bool fork_job = follow && getpid() == smash.get_pid();
+  pid_t pid = fork_job ? smash.launcher.forkShell(0) : 0;
+  if (pid == 0) {
+    if (fork_job) {
+      smash.becomeChild();
+    }
+    std::cout.flush();
+    _tailPrint(fd, out_fd, count, bytes);
+    if (follow) {
+      _tailFollow(notify_fd, fd, out_fd);
+      exit(1);
+    }
+  }
+  if (notify_fd != -1) {
+    close(notify_fd);
+  }
+  if (!use_stdin) {
+    smash.events.release(fd);
+    close(fd);
+  }
+  if (pid <= 0) {
+    if (smash.interrupted != 0) {
+      smash.setStatus(128 + smash.interrupted);
+      smash.interrupted = 0;
+    }
+    return;
+  }
+  jobs->addJob(*this, false, pid);
+  int job_id = jobs->getHighestJobID();
+  if (!getIsBgCmd()) {
+    smash.curr_job = jobs->getJobById(job_id);
+    int status = smash.waitJob(pid);
+    if (!WIFSTOPPED(status)) {
+      smash.reportUsage(job_id);
+      jobs->removeJobById(job_id);
+      smash.curr_job = nullptr;
+    }
+  }
+};
+/*** TailCommand class END ***/
+
+
+
+/*** TeeCommand class ***/
+TeeCommand::TeeCommand(const CommandLine& line) : BuiltInCommand(line) {};
+
+// tee(2) only peeks at stdin, so after copying it to stdout the same bytes are spliced into the file
+static bool _teeZeroCopy(int in_fd, int out_fd, int file_fd) {
+  if (file_fd == -1) {
+    return _copyFd(in_fd, out_fd, -1) != -1;
+  }
+  while (true) {
+    ssize_t dup_len = tee(in_fd, out_fd, PIPE_CHUNK_SIZE, 0);
+    if (dup_len == 0) {
+      return true;
+    }
+    if (dup_len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (_copyFd(in_fd, file_fd, dup_len) != dup_len) {
+      return false;
+    }
+  }
+}
+
+/**
+* tee [-a] [FILE...]
+* Copies stdin to stdout and to every FILE. When stdin and stdout are both pipes
+* and there is at most one file, the bytes never enter smash's memory.
+*/
+void TeeCommand::execute() {
+  int first = 1;
+  bool append = (argc > 1 && strcmp(args[1], "-a") == 0);
+  if (append) {
+    first++;
+  }
+  std::vector<int> fds;
+  for (int i = first; i < argc; i++) {
+    // splice refuses O_APPEND files, so appending seeks to the end instead
+    int fd = open(args[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0666);
+    if (fd == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, OPEN)
+      continue;
+    }
+    if (append) {
+      lseek(fd, 0, SEEK_END);
+    }
+    fds.push_back(fd);
+  }
+  std::cout.flush();
+
+  bool done = false;
+  if (fds.size() <= 1 && _isPipe(in_fd) && _isPipe(out_fd)) {
+    done = _teeZeroCopy(in_fd, out_fd, fds.empty() ? -1 : fds[0]);
+    if (!done && errno != EINVAL) {
+      _PRINT_PERROR(SYSCALL_ERROR, TEE)
+      done = true;
+    }
+  }
+  ssize_t len = 0;
+  while (!done && (len = read(in_fd, io_buffer, sizeof(io_buffer))) != 0) {
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      _PRINT_PERROR(SYSCALL_ERROR, READ)
+      break;
+    }
+    bool ok = _writeAll(out_fd, io_buffer, len);
+    for (int fd : fds) {
+      ok = _writeAll(fd, io_buffer, len) && ok;
+    }
+    if (!ok) {
+      _PRINT_PERROR(SYSCALL_ERROR, WRITE)
+      break;
+    }
+  }
+  for (int fd : fds) {
+    close(fd);
+  }
+};
+/*** TeeCommand class END ***/
+
+
+
+
+/*** TimesCommand class ***/
+TimesCommand::TimesCommand(const CommandLine& line, bool* report) : BuiltInCommand(line), report(report) {}
+
+/**
+* times [on|off]
+* Prints the CPU time, peak RSS and context switches of smash itself and of all
+* the children it has waited for. "on" makes every foreground job print its own
+* usage when it ends; "off" stops that.
+*/
+void TimesCommand::execute() {
+  if (argc > 2 || (argc == 2 && strcmp(args[1], "on") != 0 && strcmp(args[1], "off") != 0)) {
+    _PRINT_ERROR(INVALID_ARGS_ERROR, TIMES)
+    return;
+  }
+  if (argc == 2) {
+    *report = (strcmp(args[1], "on") == 0);
+    return;
+  }
+  struct rusage ru;
+  Usage shell = Usage();
+  Usage children = Usage();
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    shell.add(ru);
+  }
+  if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+    children.add(ru);
+  }
+  std::cout << std::fixed << std::setprecision(3)
+            << "shell:    user " << shell.user_usecs / 1e6 << "s sys " << shell.sys_usecs / 1e6 << "s maxrss "
+            << shell.maxrss_kb << "KB ctxsw " << shell.vcsw << "+" << shell.ivcsw << '\n'
+            << "children: user " << children.user_usecs / 1e6 << "s sys " << children.sys_usecs / 1e6 << "s maxrss "
+            << children.maxrss_kb << "KB ctxsw " << children.vcsw << "+" << children.ivcsw << '\n';
+  std::cout.unsetf(std::ios::floatfield);
+};
+/*** TimesCommand class END ***/
+
+
+
+
+/*** StatsCommand class ***/
+StatsCommand::StatsCommand(const CommandLine& line) : BuiltInCommand(line) {}
+
+void StatsCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  std::cout << "native spawns: " << smash.getNativeSpawns() << '\n';
+  std::cout << "bash spawns: " << smash.getBashSpawns() << '\n';
+  std::cout << "spawn backend: " << smash.launcher.getBackendName() << '\n';
+  std::cout << "avg spawn latency: " << std::fixed << std::setprecision(1)
+            << smash.launcher.getAvgSpawnUsecs() << " us" << '\n';
+  std::cout.unsetf(std::ios::floatfield);
+  HeapStats heap = heapStats();
+  std::cout << "heap allocations: " << heap.allocs << " (" << heap.frees << " freed)" << '\n';
+};
+/*** StatsCommand class END ***/
+
+
+
+/*** LauncherCommand class ***/
+LauncherCommand::LauncherCommand(const CommandLine& line, Launcher* launcher) : BuiltInCommand(line), launcher(launcher) {}
+
+void LauncherCommand::execute() {
+  if (argc > 2) {
+    _PRINT_ERROR(TOO_MANY_ARGS_ERROR, LAUNCHER)
+    return;
+  }
+  if (argc == 1) {
+    std::cout << launcher->getBackendName() << '\n';
+    return;
+  }
+  if (!launcher->setBackend(args[1])) {
+    _PRINT_ERROR(INVALID_ARGS_ERROR, LAUNCHER)
+  }
+};
+/*** LauncherCommand class END ***/
+
+
+
+/*** HashCommand class ***/
+HashCommand::HashCommand(const CommandLine& line, PathCache* cache) : BuiltInCommand(line), cache(cache) {}
+
+void HashCommand::execute() {
+  if (argc == 1) {
+    auto entries = cache->getEntries();
+    if (entries.empty()) {
+      std::cout << "smash: hash table empty" << '\n';
+      return;
+    }
+    std::cout << "hits\tcommand" << '\n';
+    for (auto& entry : entries) {
+      std::cout << std::setw(4) << entry.second.hits << "\t" << entry.second.path << '\n';
+    }
+    return;
+  }
+  if (strcmp(args[1], "-r") == 0 || strcmp(args[1], "-s") == 0) {
+    if (argc > 2) {
+      _PRINT_ERROR(TOO_MANY_ARGS_ERROR, HASH)
+    }
+    else if (args[1][1] == 'r') {
+      cache->clear();
+    }
+    else {
+      std::cout << "hits: " << cache->getHits() << '\n';
+      std::cout << "misses: " << cache->getMisses() << '\n';
+    }
+    return;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (strchr(args[i], '/') == nullptr && !cache->warm(args[i])) {
+      _PRINT_ERROR_JOB_ID(NOT_FOUND_ERROR_START, NOT_FOUND_ERROR_END, HASH, args[i])
+    }
+  }
+};
+/*** HashCommand class END ***/
+
+
+
+
+/*** ParallelCommand class ***/
+ParallelCommand::ParallelCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
+
+// Moves what a task wrote into its memfd to our stdout, and closes the memfd
+static void _dumpOutput(int fd, int out_fd) {
+  flushOutput();
+  if (lseek(fd, 0, SEEK_SET) == -1 || _copyFd(fd, out_fd, -1) == -1) {
+    _PRINT_PERROR(SYSCALL_ERROR, WRITE)
+  }
+  close(fd);
+}
+
+/**
+* Starts one line in a new process group: external commands are exec'd directly,
+* anything else gets a forked smash. in_fd and out_fd (-1 for none) override the
+* stdin and stdout/stderr parallel itself was given, redirected or not.
+*/
+pid_t ParallelCommand::launch(Command* cmd, const CommandLine& task, int in_fd, int out_fd) {
+  SmallShell& smash = SmallShell::getInstance();
+  int task_in = (in_fd != -1) ? in_fd : this->in_fd;
+  int task_out = (out_fd != -1) ? out_fd : this->out_fd;
+  int task_err = (out_fd != -1) ? out_fd : this->err_fd;
+  if (cmd->getKind() == CMD_EXTERNAL) {
+    SpawnSpec spec;
+    Redirector redir;
+    if (!_prepareSpawn(spec, redir, task.commands[0], cmd->getCmdLine(), task.commands[0].argv, task.commands[0].argc)) {
+      return -1;
+    }
+    spec.pgid = 0;
+    if (task_in != STDIN_FILENO) {
+      spec.addDup(task_in, STDIN_FILENO);
+    }
+    if (task_out != STDOUT_FILENO) {
+      spec.addDup(task_out, STDOUT_FILENO);
+    }
+    if (task_err != STDERR_FILENO) {
+      spec.addDup(task_err, STDERR_FILENO);
+    }
+    redir.addTo(spec);
+    return smash.launcher.spawn(spec);
+  }
+  pid_t pid = smash.launcher.forkShell(0);
+  if (pid == 0) {
+    smash.becomeChild();
+    if ((task_in != STDIN_FILENO && dup2(task_in, STDIN_FILENO) == -1) ||
+        (task_out != STDOUT_FILENO && dup2(task_out, STDOUT_FILENO) == -1) ||
+        (task_err != STDERR_FILENO && dup2(task_err, STDERR_FILENO) == -1)) {
+      _PRINT_PERROR(SYSCALL_ERROR, DUP)
+      exit(1);
+    }
+    smash.executeLine(task);
+    exit(smash.getStatus());
+  }
+  return pid;
+}
+
+/**
+* parallel [-j N] [-g | -k] [-l LOGFILE] [FILE|-]
+* Runs every line of FILE (or stdin) as its own job, at most N at a time (default:
+* one per online CPU). A job is started the moment another exits: smash sleeps in
+* its event loop until SIGCHLD, it never polls. Output is interleaved, or with -g each
+* command's output is printed in one piece when it exits; -k does the same in
+* input order. LOGFILE gets a line per command with its exit status and run time.
+* The status is the number of commands that failed, up to PARALLEL_MAX_FAILED.
+* ctrl-C kills the running commands; ctrl-Z stops them and leaves them in the jobs
+* list (with -g, what they write after that is lost). Either way no more are started.
+*/
+void ParallelCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  bool grouped = false;
+  bool keep_order = false;
+  const char* log_file = nullptr;
+  const char* file = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(args[i], "-j") == 0 && i + 1 < argc) {
+      workers = argToInt(args[++i]);
+    }
+    else if (strcmp(args[i], "-g") == 0) {
+      grouped = true;
+    }
+    else if (strcmp(args[i], "-k") == 0) {
+      grouped = keep_order = true;
+    }
+    else if (strcmp(args[i], "-l") == 0 && i + 1 < argc) {
+      log_file = args[++i];
+    }
+    else if (file == nullptr && (args[i][0] != '-' || strcmp(args[i], "-") == 0)) {
+      file = args[i];
+    }
+    else {
+      workers = 0;
+      break;
+    }
+  }
+  if (workers < 1 || workers > SHELL_MAX_PROCESSES) {
+    _PRINT_ERROR(INVALID_ARGS_ERROR, PARALLEL)
+    return;
+  }
+  bool from_stdin = (file == nullptr || strcmp(file, "-") == 0);
+  ScriptReader reader;
+  if (!(from_stdin ? reader.attach(in_fd) : reader.open(file))) {
+    _PRINT_PERROR(SYSCALL_ERROR, OPEN)
+    return;
+  }
+  int log_fd = -1;
+  if (log_file != nullptr) {
+    log_fd = open(log_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (log_fd == -1) {
+      _PRINT_PERROR(SYSCALL_ERROR, OPEN)
+      return;
+    }
+  }
+  // commands read from stdin must not be eaten by the commands themselves
+  int null_fd = from_stdin ? open("/dev/null", O_RDONLY | O_CLOEXEC) : -1;
+
+  std::vector<ReapQueue::Entry> reaped;
+  smash.reap_log = &reaped;
+  smash.interrupted = 0;
+
+  std::unordered_map<pid_t, Task> running;
+  std::map<long, int> done_out;  // -k: output of commands that finished ahead of their turn
+  long next_seq = 0;
+  long next_print = 0;
+  long failed = 0;
+  bool more = true;
+  auto finish = [&](std::unordered_map<pid_t, Task>::iterator it, int code) {
+    const Task& task = it->second;
+    failed += (code != 0);
+    if (log_fd != -1) {
+      std::string entry = std::to_string(task.seq + 1) + "\t" + std::to_string(it->first) + "\t" +
+                          std::to_string(code) + "\t" +
+                          std::to_string((TimerQueue::now() - task.start) / 1000000) + "ms\t" + task.cmd_line + "\n";
+      _writeAll(log_fd, entry.data(), entry.size());
+    }
+    jobs->removeJobByPid(it->first);
+    if (task.out_fd != -1 && !keep_order) {
+      _dumpOutput(task.out_fd, this->out_fd);
+    }
+    else if (task.out_fd != -1) {
+      done_out[task.seq] = task.out_fd;
+      for (auto next = done_out.begin(); next != done_out.end() && next->first == next_print; next = done_out.begin()) {
+        _dumpOutput(next->second, this->out_fd);
+        done_out.erase(next);
+        next_print++;
+      }
+    }
+    running.erase(it);
+  };
+  auto inputOrder = [&]() {
+    std::vector<std::pair<long, pid_t>> order;
+    for (auto& task : running) {
+      order.push_back({task.second.seq, task.first});
+    }
+    std::sort(order.begin(), order.end());
+    return order;
+  };
+
+  while (true) {
+    std::string_view text;
+    while (more && (long)running.size() < workers && smash.interrupted == 0) {
+      if (!reader.nextLine(text)) {
+        more = false;
+        break;
+      }
+      if (trimView(text).empty()) {
+        continue;
+      }
+      Arena::Mark mark = smash.parser.mark();
+      try {
+        CommandLine task = *smash.parser.parse(text);
+        task.background = false;
+        int out_fd = grouped ? memfd_create(PARALLEL, MFD_CLOEXEC) : -1;
+        if (grouped && out_fd == -1) {
+          _PRINT_PERROR(SYSCALL_ERROR, OPEN)
+          more = false;
+        }
+        else {
+          std::unique_ptr<Command> cmd = smash.CreateCommand(task);
+          pid_t pid = launch(cmd.get(), task, null_fd, out_fd);
+          if (pid == -1) {
+            if (out_fd != -1) {
+              close(out_fd);
+            }
+            failed++;
+          }
+          else {
+            jobs->addJob(*cmd, false, pid);
+            running[pid] = {next_seq++, out_fd, TimerQueue::now(), std::string(task.body)};
+          }
+        }
+      } catch (std::bad_alloc&) {
+        more = false;
+      }
+      smash.parser.release(mark);
+    }
+    if (running.empty()) {
+      break;
+    }
+
+    ReapQueue::Entry entry;
+    if (!reaped.empty()) {
+      entry = reaped.back();
+      reaped.pop_back();
+    }
+    else if (!ReapQueue::pop(entry)) {
+      if (ReapQueue::takeOverflow()) {
+        // the queue filled up before every exited command was reaped
+        chldHandler(SIGCHLD);
+        continue;
+      }
+      if (smash.interrupted == SIGINT) {
+        for (auto& task : inputOrder()) {
+          kill(-task.second, SIGKILL);
+          std::cout << "smash: process " << task.second << " was killed" << '\n';
+        }
+        smash.interrupted = 0;
+        more = false;
+      }
+      else if (smash.interrupted == SIGTSTP) {
+        for (auto& done : done_out) {
+          _dumpOutput(done.second, this->out_fd);
+        }
+        for (auto& task : inputOrder()) {
+          JobsList::JobEntry* je = jobs->getJobByPid(task.second);
+          if (je != nullptr) {
+            je->setStopped(true);
+          }
+          kill(-task.second, SIGSTOP);
+          std::cout << "smash: process " << task.second << " was stopped" << '\n';
+          if (running[task.second].out_fd != -1) {
+            _dumpOutput(running[task.second].out_fd, this->out_fd);
+          }
+        }
+        break;
+      }
+      else {
+        smash.events.wait();
+      }
+      continue;
+    }
+    auto it = running.find(entry.pid);
+    if (it == running.end()) {
+      // one of the shell's other jobs
+      smash.settleReaped(entry);
+      continue;
+    }
+    finish(it, _exitCode(entry.status));
+  }
+
+  smash.reap_log = nullptr;
+  smash.interrupted = 0;
+  if (null_fd != -1) {
+    close(null_fd);
+  }
+  if (log_fd != -1) {
+    close(log_fd);
+  }
+  smash.setStatus((failed > PARALLEL_MAX_FAILED) ? PARALLEL_MAX_FAILED : failed);
+};
+/*** ParallelCommand class END ***/
+
+
+
+
+/*** WaitCommand class ***/
+WaitCommand::WaitCommand(const CommandLine& line, JobsList* jobs) : BuiltInCommand(line), jobs(jobs) {}
+
+/**
+* wait [-n] [job-id...]: blocks until the given jobs (all running ones without
+* ids) are done, or with -n until the first of them is, and takes on the exit
+* status of the last one to finish. The leaders' pidfds sit in one epoll
+* instance that the EventLoop watches next to the signalfd, so the whole wait
+* is a single epoll_wait that ctrl-C can still interrupt.
+*/
+void WaitCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  bool any = false;
+  int result = 0;
+  std::vector<int> waited;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(args[i], "-n") == 0) {
+      any = true;
+      continue;
+    }
+    int job_id = argToInt(args[i]);
+    if (job_id <= 0) {
+      _PRINT_ERROR(INVALID_ARGS_ERROR, WAIT)
+      return;
+    }
+    if (jobs->getJobById(job_id) != nullptr) {
+      waited.push_back(job_id);
+    }
+    // it may well have finished before the script got here
+    else if (!jobs->takeExitStatus(job_id, &result)) {
+      _PRINT_ERROR_JOB_ID(JOB_NOT_EXIST_ERROR_START, JOB_NOT_EXIST_ERROR_END, WAIT, job_id)
+      return;
+    }
+  }
+  if (argc == 1 || (any && argc == 2)) {
+    // a stopped job would never finish by itself
+    for (int job_id = 1; job_id <= jobs->getHighestJobID(); job_id++) {
+      JobsList::JobEntry* je = jobs->getJobById(job_id);
+      if (je != nullptr && !je->JobIsStopped()) {
+        waited.push_back(job_id);
+      }
+    }
+  }
+  if (waited.empty()) {
+    smash.setStatus(result);
+    return;
+  }
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    _PRINT_PERROR(SYSCALL_ERROR, EPOLL)
+    return;
+  }
+  for (int job_id : waited) {
+    // one-shot: a leader's pidfd stays readable once it exits, while the rest of its pipeline may not have
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u32 = job_id;
+    int pidfd = jobs->getJobById(job_id)->getPidfd();
+    if (pidfd != -1) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &ev);
+    }
+  }
+
+  smash.interrupted = 0;
+  while (true) {
+    smash.reapJobs();
+    bool done = false;
+    for (auto it = waited.begin(); it != waited.end();) {
+      if (jobs->getJobById(*it) == nullptr) {
+        jobs->takeExitStatus(*it, &result);
+        it = waited.erase(it);
+        done = true;
+      }
+      else {
+        it++;
+      }
+    }
+    if (waited.empty() || (any && done)) {
+      break;
+    }
+    if (smash.interrupted != 0) {
+      result = 128 + smash.interrupted;
+      break;
+    }
+    if (smash.events.wait(epoll_fd)) {
+      // takes the ready pidfds off the set; their jobs are settled by reapJobs above
+      struct epoll_event ready[EVENTS_MAX];
+      epoll_wait(epoll_fd, ready, EVENTS_MAX, 0);
+    }
+  }
+
+  smash.events.release(epoll_fd);
+  close(epoll_fd);
+  smash.interrupted = 0;
+  smash.setStatus(result);
+};
+/*** WaitCommand class END ***/
@@ -2,41 +2,82 @@
 #define SMASH_COMMAND_H_
 
 #include <vector>
+#include <unordered_map>
+#include <signal.h>
+#include <string>
+#include <memory>
+#include "launcher.h"
+#include "timers.h"
+#include "parser.h"
+#include "signals.h"
+#include "events.h"
+#include "pool.h"
+#include "redirect.h"
 
-#define COMMAND_ARGS_MAX_LENGTH (200)
-#define COMMAND_MAX_ARGS (20)
-#define SHELL_MAX_PROCESSES (100)
+#define SHELL_MAX_PROCESSES (4096)
+#define IO_BUFFER_SIZE (64 * 1024)
+#define PIPE_CHUNK_SIZE (1024 * 1024)
+#define CAT_CHUNK_SIZE (64 * 1024 * 1024)  // cat checks for ctrl-C between these
+#define TAIL_KEEP_SIZE (1024 * 1024)      // tail of a pipe trims what it keeps past this
+#define TAIL_EVENTS_SIZE (4096)
+#define PARALLEL_MAX_FAILED (101)  // parallel's status counts failed commands up to this
+
+// Builtin flags
+#define BUILTIN_IN_PROCESS (1 << 0)  // runs inside smash rather than in a child
+#define BUILTIN_PIPELINE   (1 << 1)  // only writes output, so smash itself can feed a pipe with it
+#define BUILTIN_RAW_FDS    (1 << 2)  // moves bytes between fds itself, so it can run on redirected ones in smash
+
+// What a command is, so callers never have to probe types
+enum CommandKind {
+  CMD_BUILTIN,      // runs in smash
+  CMD_EXTERNAL,     // starts a job, which takes its command line over
+  CMD_TIMEOUT,
+  CMD_PIPE,
+  CMD_REDIRECTION   // runs a nested line in smash
+};
 
 
 class Command {
 protected:
-  char* cmd_line;
-  char* org_cmd_line;
+  std::string cmd_line;
+  std::string org_cmd_line;
+  // args and line point into the parser's arena: only valid during execute()
   int argc;
   char** args;
+  CommandLine line;
   bool isBgCmd;
+  CommandKind kind;
 public:
-  Command(const char* cmd_line);
-  Command() {};
+  Command(const CommandLine& line, CommandKind kind);
   virtual ~Command();
   virtual void execute() = 0;
   //virtual void prepare();
   //virtual void cleanup();
-  char* getCmdLine();
+  const char* getCmdLine();
   char** getArgs();
   const char* getOldCmdLine();
+  std::string takeCmdLine();
+  std::string takeOldCmdLine();
   bool getIsBgCmd();
+  CommandKind getKind();
+  static void* operator new(size_t size);
+  static void operator delete(void* mem, size_t size);
 };
 
 class BuiltInCommand : public Command {
+protected:
+  int in_fd;   // stdin, stdout and stderr, unless a redirection gave it others
+  int out_fd;
+  int err_fd;
 public:
-  BuiltInCommand(const char* cmd_line);
+  BuiltInCommand(const CommandLine& line);
   virtual ~BuiltInCommand() {}
+  void setFds(int in_fd, int out_fd, int err_fd = STDERR_FILENO);
 };
 
 class ExternalCommand : public Command {
 public:
-  ExternalCommand(const char* cmd_line);
+  ExternalCommand(const CommandLine& line);
   virtual ~ExternalCommand() {}
   void execute() override;
 };
@@ -44,7 +85,7 @@ public:
 
 class TimeoutCommand : public Command {
 public:
-  TimeoutCommand(const char* cmd_line);
+  TimeoutCommand(const CommandLine& line);
   virtual ~TimeoutCommand() {}
   void execute() override;
 };
@@ -54,30 +95,30 @@ private:
   char** oldpwd;
   bool* pwd_exist;
 public:
-  ChangeDirCommand(const char* cmd_line, char** plastPwd, bool* pwd_exist);
+  ChangeDirCommand(const CommandLine& line, char** plastPwd, bool* pwd_exist);
   virtual ~ChangeDirCommand() {}
   void execute() override;
 };
 
 class GetCurrDirCommand : public BuiltInCommand {
 public:
-  GetCurrDirCommand(const char* cmd_line);
+  GetCurrDirCommand(const CommandLine& line);
   virtual ~GetCurrDirCommand() {}
   void execute() override;
 };
 
 class ShowPidCommand : public BuiltInCommand {
 public:
-  ShowPidCommand(const char* cmd_line);
+  ShowPidCommand(const CommandLine& line);
   virtual ~ShowPidCommand() {}
   void execute() override;
 };
 
 class ChangePromptCommand : public BuiltInCommand {
 private:
-  char** prompt_ptr;
+  std::string* prompt_ptr;
 public:
-  ChangePromptCommand(const char* cmd_line, char** prompt);
+  ChangePromptCommand(const CommandLine& line, std::string* prompt);
   virtual ~ChangePromptCommand() {}
   void execute() override;
 };
@@ -93,75 +134,88 @@ public:
     time_t insert_time;
     pid_t pid;
     bool isStopped;
-    Command* cmd;
+    int pidfd;                   // of the leader, -1 if the kernel has no pidfd_open
+    std::string cmd_line;
+    std::string org_cmd_line;
+    std::vector<pid_t> running;  // processes of the job that have not exited yet
+    pid_t last_pid;              // the last one added, whose exit status the job reports
+    int exit_status;
+    long long start_nsecs;
+    Usage usage;                 // of the processes that have exited
   public:
-    JobEntry(Command* cmd, int job_id, bool isStopped, pid_t pid);
+    JobEntry(std::string&& cmd_line, std::string&& org_cmd_line, int job_id, bool isStopped, pid_t pid, int pidfd);
+    JobEntry(JobEntry const&) = delete;
+    void operator=(JobEntry const&) = delete;
     bool operator<(const JobEntry &rhs);
     bool operator>(const JobEntry &rhs);
     bool operator==(const JobEntry &rhs);
     int getJobId() const;
     void setStopped(bool val);
-    char* getJobCmd();
-    Command* getCmd();
+    const char* getJobCmd();
     const char* getOldCmdLine();
     int getJobPid();
+    int getPidfd();
+    const std::vector<pid_t>& getRunningPids();
+    void addProcess(pid_t process);
+    bool processExited(pid_t process);
+    void setExitStatus(pid_t process, int status);
+    int getExitStatus();
+    int signalJob(int sig);
+    void addUsage(const Usage& exited);
+    Usage getUsage();
+    long long getRealNsecs();
     time_t getJobInsertTime();
     bool JobIsStopped();
     ~JobEntry();
   };
 
 private:
-  std::vector<JobEntry*> jobs;
+  // Job entries come from a pool and are indexed by job id, so walking slots is job-id order
+  ObjectPool<JobEntry> entries;
+  std::vector<JobEntry*> slots;
+  std::unordered_map<pid_t, int> pid_index;
+  std::unordered_map<int, int> finished;  // exit status of removed jobs, until their id is reused
+  int max_job_id;
+  int count;
+  void removeSlot(int jobId);
 public:
   JobsList();
   ~JobsList();
-  class JobIsBigger { 
-  public:
-    bool operator()(const JobEntry *j1, const JobEntry *j2);
-  };
-  class JobIsTimeout { 
-  public:
-    bool operator()(JobEntry *j1, JobEntry *j2);
-  };
-
-  void addJob(Command* cmd, bool isStopped, pid_t pid);
+  void addJob(Command& cmd, bool isStopped, pid_t pid, int pidfd = -1);
+  void addJobProcess(int jobId, pid_t pid);
   int size();
   void printKillJobs();
-  void sortTimeout();
-  void setAlarm();
   int getHighestJobID();
-  void printJobsList();
+  void printJobsList(bool verbose = false);
   void killAllJobs();
-  void removeFinishedJobs(bool del = true);
   JobEntry * getJobById(int jobId);
-  JobEntry * getFirst();
-  void removeJobById(int jobId, bool del = true);
-  void removeJobByPid(int jobPid, bool del = true);
-  JobEntry * getLastJob(int* lastJobId);
+  JobEntry * getJobByPid(pid_t pid);
+  void removeJobById(int jobId);
+  void removeJobByPid(int jobPid);
+  void addUsage(pid_t pid, const Usage& usage);
+  void setExitStatus(pid_t pid, int status);
+  bool takeExitStatus(int jobId, int* status);
   JobEntry *getLastStoppedJob(int *jobId);
 };
 
 
 
 class PipeCommand : public Command {
-  bool isStderr;
-  std::string cmd1;
-  std::string cmd2;
+private:
+  pid_t launchStage(int stage, int in_fd, int out_fd, pid_t pgid, const std::vector<int>& pipe_fds);
 public:
-  bool isSon;
-  PipeCommand(const char* cmd_line);
+  PipeCommand(const CommandLine& line);
   virtual ~PipeCommand() {}
   void execute() override;
 };
 
 class RedirectionCommand : public Command {
 private:
-  JobsList* jl;
-  std::string cmd;
-  std::string file;
-  bool isAppend;
+  unsigned flags;      // the builtin's BUILTIN_* flags
+  CommandLine inner;   // the line without its redirections
+  SimpleCommand bare;
 public:
-  explicit RedirectionCommand(const char* cmd_line, JobsList* jl);
+  RedirectionCommand(const CommandLine& line, unsigned flags);
   virtual ~RedirectionCommand() {}
   void execute() override;
 };
@@ -170,7 +224,7 @@ class JobsCommand : public BuiltInCommand {
 private:
   JobsList* jobs;
 public:
-  JobsCommand(const char* cmd_line, JobsList* jobs);
+  JobsCommand(const CommandLine& line, JobsList* jobs);
   virtual ~JobsCommand() {}
   void execute() override;
 };
@@ -179,7 +233,7 @@ class QuitCommand : public BuiltInCommand {
 private:
   JobsList* jobs;
 public:
-  QuitCommand(const char* cmd_line, JobsList* jobs);
+  QuitCommand(const CommandLine& line, JobsList* jobs);
   virtual ~QuitCommand() {}
   void execute() override;
 };
@@ -188,7 +242,7 @@ class ForegroundCommand : public BuiltInCommand {
 private:
   JobsList* jobs;
 public:
-  ForegroundCommand(const char* cmd_line, JobsList* jobs);
+  ForegroundCommand(const CommandLine& line, JobsList* jobs);
   virtual ~ForegroundCommand() {}
   void execute() override;
 };
@@ -197,7 +251,7 @@ class KillCommand : public BuiltInCommand {
 private:
   JobsList* jobs;
 public:
-  KillCommand(const char* cmd_line, JobsList* jobs);
+  KillCommand(const CommandLine& line, JobsList* jobs);
   virtual ~KillCommand() {}
   void execute() override;
 };
@@ -206,31 +260,137 @@ class BackgroundCommand : public BuiltInCommand {
 private:
   JobsList* jobs;
 public:
-  BackgroundCommand(const char* cmd_line, JobsList* jobs);
+  BackgroundCommand(const CommandLine& line, JobsList* jobs);
   virtual ~BackgroundCommand() {}
   void execute() override;
 };
 
 class HeadCommand : public BuiltInCommand {
 public:
-  HeadCommand(const char* cmd_line);
+  HeadCommand(const CommandLine& line);
   virtual ~HeadCommand() {}
   void execute() override;
 };
 
+class CatCommand : public BuiltInCommand {
+public:
+  CatCommand(const CommandLine& line);
+  virtual ~CatCommand() {}
+  void execute() override;
+};
+
+class TailCommand : public BuiltInCommand {
+private:
+  JobsList* jobs;
+public:
+  TailCommand(const CommandLine& line, JobsList* jobs);
+  virtual ~TailCommand() {}
+  void execute() override;
+};
+
+class TeeCommand : public BuiltInCommand {
+public:
+  TeeCommand(const CommandLine& line);
+  virtual ~TeeCommand() {}
+  void execute() override;
+};
+
+class TimesCommand : public BuiltInCommand {
+private:
+  bool* report;
+public:
+  TimesCommand(const CommandLine& line, bool* report);
+  virtual ~TimesCommand() {}
+  void execute() override;
+};
+
+class StatsCommand : public BuiltInCommand {
+public:
+  StatsCommand(const CommandLine& line);
+  virtual ~StatsCommand() {}
+  void execute() override;
+};
+
+class HashCommand : public BuiltInCommand {
+private:
+  PathCache* cache;
+public:
+  HashCommand(const CommandLine& line, PathCache* cache);
+  virtual ~HashCommand() {}
+  void execute() override;
+};
+
+class LauncherCommand : public BuiltInCommand {
+private:
+  Launcher* launcher;
+public:
+  LauncherCommand(const CommandLine& line, Launcher* launcher);
+  virtual ~LauncherCommand() {}
+  void execute() override;
+};
+
+class ParallelCommand : public BuiltInCommand {
+private:
+  class Task {
+  public:
+    long seq;
+    int out_fd;          // memfd holding its output with -g or -k, else -1
+    long long start;
+    std::string cmd_line;
+  };
+  JobsList* jobs;
+  pid_t launch(Command* cmd, const CommandLine& task, int in_fd, int out_fd);
+public:
+  ParallelCommand(const CommandLine& line, JobsList* jobs);
+  virtual ~ParallelCommand() {}
+  void execute() override;
+};
+
+class WaitCommand : public BuiltInCommand {
+private:
+  JobsList* jobs;
+public:
+  WaitCommand(const CommandLine& line, JobsList* jobs);
+  virtual ~WaitCommand() {}
+  void execute() override;
+};
+
+
+class SmallShell;
+
+/**
+* A row of the builtin registry: its name, how to build it and its BUILTIN_* flags.
+*/
+class BuiltinEntry {
+public:
+  const char* name;
+  Command* (*create)(const CommandLine& line, SmallShell& smash);
+  unsigned flags;
+  bool (*handles)(const SimpleCommand& cmd);  // if set and false, the program of the same name runs instead
+};
 
 class SmallShell {
 private:
-  char* prompt;
+  std::string prompt;
   bool oldwd_exist;
   char* oldwd;
   pid_t pid;
+  long native_spawns;
+  long bash_spawns;
+  int status;
+  bool report_usage;
   SmallShell();
 public:
   JobsList::JobEntry* curr_job;
+  int interrupted;                               // last ctrl-C/ctrl-Z signal, for builtins that wait themselves
+  std::vector<ReapQueue::Entry>* reap_log;       // if set, reapJobs also hands the statuses over here
   JobsList jl;
-  JobsList timeoutlist;
-  Command *CreateCommand(const char* cmd_line);
+  TimerQueue timers;
+  Launcher launcher;
+  EventLoop events;
+  Parser parser;
+  std::unique_ptr<Command> CreateCommand(const CommandLine& line);
+  static const BuiltinEntry* findBuiltin(std::string_view name);
   SmallShell(SmallShell const&)      = delete; // disable copy ctor
   void operator=(SmallShell const&)  = delete; // disable = operator
   static SmallShell& getInstance()             // make SmallShell singleton
@@ -240,9 +400,21 @@ public:
     return instance;
   }
   pid_t get_pid();
+  void reapJobs();
+  void settleReaped(const ReapQueue::Entry& entry);
+  int waitJob(pid_t pid);
+  int waitPids(const std::vector<pid_t>& pids);
+  void countSpawn(bool native);
+  long getNativeSpawns();
+  long getBashSpawns();
   const char* getPrompt();
+  void reportUsage(int job_id);
+  void becomeChild();
+  int getStatus();
+  void setStatus(int status);
   ~SmallShell();
-  void executeCommand(const char* cmd_line);
+  void executeCommand(std::string_view cmd_line);
+  void executeLine(const CommandLine& line);
 };
 
 #endif //SMASH_COMMAND_H_
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <string_view>
+#include <vector>
+#include "parser.h"
+#include "Commands.h"
+#include "pool.h"
+
+// Micro-benchmarks for the hot paths of a line that never leaves smash:
+// parsing it, and finding and building the builtin it names, and how often
+// that path still goes to the heap.
+// Usage: ./microbench [--json] [iterations]
+
+static const char* PARSE_LINES[] = {
+  "ls",
+  "sleep 10&",
+  "ls -l /usr/bin | grep sh | sort -r | head -5",
+  "cat not_a_real_path |& tail -c 12",
+  "echo hello world from the smash shell > out.txt",
+  "timeout -s TERM -k 2 1.5s make -j8 all >> build.log &",
+};
+
+// A builtin-heavy script, with the odd external command in between
+static const char* SCRIPT_LINES[] = {
+  "pwd", "showpid", "jobs", "chprompt bench", "cd .", "kill -9 1", "fg 1", "bg 1",
+  "quit", "head -1 file", "stats", "hash", "launcher", "tee out", "timeout 1 ls", "ls -l",
+};
+
+class Result {
+public:
+  const char* group;
+  const char* name;
+  double value;
+  const char* unit;
+};
+
+static bool json = false;
+static std::vector<Result> results;
+
+// A table row, or with --json a record printed at the end
+static void report(const char* group, const char* name, double value, const char* unit = "lines/s") {
+  if (json) {
+    results.push_back({group, name, value, unit});
+    return;
+  }
+  printf("%-9s %-56s %14.2f %s\n", group, name, value, unit);
+}
+
+static void printJson() {
+  printf("[\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    printf("  {\"group\": \"%s\", \"case\": \"%s\", \"value\": %.2f, \"unit\": \"%s\"}%s\n",
+           results[i].group, results[i].name, results[i].value, results[i].unit, (i + 1 < results.size()) ? "," : "");
+  }
+  printf("]\n");
+}
+
+static long long nowNsecs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// How CreateCommand used to find a builtin: one compare per known name
+static int legacyLookup(std::string_view firstWord) {
+  static const char* names[] = {"timeout", "pwd", "showpid", "chprompt", "cd", "jobs", "kill", "fg",
+                                "bg", "quit", "head", "tee", "stats", "launcher", "hash"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (firstWord.compare(names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void benchParse(long iterations) {
+  Parser parser;
+  long words = 0;
+  for (const char* text : PARSE_LINES) {
+    long long start = nowNsecs();
+    for (long n = 0; n < iterations; n++) {
+      Arena::Mark mark = parser.mark();
+      const CommandLine* line = parser.parse(text);
+      words += line->commands[line->count - 1].argc;
+      parser.release(mark);
+    }
+    double secs = (nowNsecs() - start) / 1e9;
+    report("parse", text, iterations / secs);
+  }
+  if (words == 0) {
+    printf("nothing parsed\n");
+  }
+}
+
+static void benchDispatch(long iterations) {
+  size_t nlines = sizeof(SCRIPT_LINES) / sizeof(SCRIPT_LINES[0]);
+  std::string_view names[sizeof(SCRIPT_LINES) / sizeof(SCRIPT_LINES[0])];
+  for (size_t i = 0; i < nlines; i++) {
+    std::string_view line(SCRIPT_LINES[i]);
+    names[i] = line.substr(0, line.find(' '));
+  }
+  long found = 0;
+  long long start = nowNsecs();
+  for (long n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < nlines; i++) {
+      found += (legacyLookup(names[i]) >= 0);
+    }
+  }
+  double legacy_secs = (nowNsecs() - start) / 1e9;
+  start = nowNsecs();
+  for (long n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < nlines; i++) {
+      found += (SmallShell::findBuiltin(names[i]) != nullptr);
+    }
+  }
+  double registry_secs = (nowNsecs() - start) / 1e9;
+  report("lookup", "if/else compare chain", iterations * nlines / legacy_secs);
+  report("lookup", "builtin registry", iterations * nlines / registry_secs);
+
+  // the whole path from text to a ready Command
+  SmallShell& smash = SmallShell::getInstance();
+  long creates = iterations / 10;
+  HeapStats before = heapStats();
+  start = nowNsecs();
+  for (long n = 0; n < creates; n++) {
+    for (size_t i = 0; i < nlines; i++) {
+      Arena::Mark mark = smash.parser.mark();
+      std::unique_ptr<Command> cmd = smash.CreateCommand(*smash.parser.parse(SCRIPT_LINES[i]));
+      found += (cmd->getKind() == CMD_BUILTIN);
+      cmd.reset();
+      smash.parser.release(mark);
+    }
+  }
+  double create_secs = (nowNsecs() - start) / 1e9;
+  HeapStats after = heapStats();
+  report("dispatch", "parse + CreateCommand + delete", creates * nlines / create_secs);
+  report("heap", "allocations per line", (double)(after.allocs - before.allocs) / (creates * nlines), "allocs");
+  if (found == 0) {
+    printf("nothing found\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "--json") == 0) {
+    json = true;
+    arg++;
+  }
+  long iterations = (arg < argc) ? atol(argv[arg]) : 1000000;
+  benchParse(iterations);
+  benchDispatch(iterations);
+  if (json) {
+    printJson();
+  }
+  return 0;
+}
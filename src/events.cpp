@@ -0,0 +1,215 @@
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <algorithm>
+#include "events.h"
+#include "signals.h"
+#include "output.h"
+
+using namespace std;
+
+
+
+/*** EventLoop class ***/
+EventLoop::EventLoop() : epoll_fd(-1), signal_fd(-1), timer_fd(-1), input_fd(-1) {
+  sigemptyset(&mask);
+  sigemptyset(&orig_mask);
+}
+
+EventLoop::~EventLoop() {
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+  }
+  if (signal_fd != -1) {
+    close(signal_fd);
+  }
+}
+
+bool EventLoop::watch(int fd) {
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+/**
+* Blocks the signals smash handles and starts delivering them through the loop.
+* Children undo the block themselves before they exec (see SpawnSpec).
+*/
+bool EventLoop::init(int timer_fd) {
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTSTP);
+  sigaddset(&mask, SIGALRM);
+  // a pipe whose reader is gone fails the write with EPIPE instead
+  sigaddset(&mask, SIGPIPE);
+  if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) == -1) {
+    return false;
+  }
+  return listen(timer_fd);
+}
+
+bool EventLoop::listen(int timer_fd) {
+  signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->timer_fd = timer_fd;
+  return signal_fd != -1 && epoll_fd != -1 && watch(signal_fd) && (timer_fd == -1 || watch(timer_fd));
+}
+
+/**
+* For a forked smash: the epoll instance is shared with the parent, so the child
+* gets its own. It still reaps its own children through SIGCHLD, but is a job
+* itself, so every other signal goes back to the mask smash started with: ctrl-C,
+* ctrl-Z, kill and a closed pipe act on it like on any other process. The
+* parent's feeders are its own business, and a copy of their pipes here would
+* keep the readers from EOF.
+*/
+void EventLoop::reset(int timer_fd) {
+  for (Feeder& feeder : feeders) {
+    close(feeder.fd);
+  }
+  feeders.clear();
+  if (epoll_fd == -1) {
+    return;
+  }
+  close(epoll_fd);
+  close(signal_fd);
+  epoll_fd = -1;
+  signal_fd = -1;
+  input_fd = -1;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigset_t child_mask = orig_mask;
+  sigaddset(&child_mask, SIGCHLD);
+  sigprocmask(SIG_SETMASK, &child_mask, nullptr);
+  listen(timer_fd);
+}
+
+void EventLoop::dispatch(int fd) {
+  if (fd == signal_fd) {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+      switch (info.ssi_signo) {
+        case SIGCHLD:
+          chldHandler(SIGCHLD);
+          break;
+        case SIGINT:
+          ctrlCHandler(SIGINT);
+          break;
+        case SIGTSTP:
+          ctrlZHandler(SIGTSTP);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  else if (fd == timer_fd) {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+      alarmHandler(SIGALRM);
+    }
+  }
+  else {
+    auto iter = std::find_if(feeders.begin(), feeders.end(), [fd](const Feeder& f) { return f.fd == fd; });
+    if (iter != feeders.end() && pump(*iter)) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+      close(fd);
+      feeders.erase(iter);
+    }
+  }
+}
+
+// Writes what the pipe takes; true once the feeder is done, or its reader is gone
+bool EventLoop::pump(Feeder& feeder) {
+  while (feeder.written < feeder.data.size()) {
+    ssize_t written = write(feeder.fd, feeder.data.data() + feeder.written, feeder.data.size() - feeder.written);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno != EAGAIN;
+    }
+    feeder.written += written;
+  }
+  return true;
+}
+
+/**
+* Takes the pipe fd over, writes data into it and closes it, without ever
+* blocking: what the reader has no room for yet goes out from wait() later.
+*/
+void EventLoop::feed(int fd, std::string&& data) {
+  Feeder feeder = {fd, std::move(data), 0};
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 || pump(feeder)) {
+    close(fd);
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLOUT;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    close(fd);
+    return;
+  }
+  feeders.push_back(std::move(feeder));
+}
+
+/**
+* Sleeps until a signal or timer has been handled, or until input is readable.
+* Returns true in the last case. Buffered output is flushed first: whoever is
+* waiting has nothing more to say until something happens.
+*/
+bool EventLoop::wait(int input) {
+  flushOutput();
+  if (input != input_fd) {
+    if (input_fd != -1) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, nullptr);
+    }
+    input_fd = -1;
+    if (input != -1 && !watch(input)) {
+      // a regular file (EPERM) is always readable; anything else, let the read report it
+      return true;
+    }
+    input_fd = input;
+  }
+  struct epoll_event events[EVENTS_MAX];
+  int count;
+  do {
+    count = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+  } while (count == -1 && errno == EINTR);
+  bool readable = false;
+  for (int i = 0; i < count; i++) {
+    if (input != -1 && events[i].data.fd == input) {
+      readable = true;
+    }
+    else {
+      dispatch(events[i].data.fd);
+    }
+  }
+  return readable;
+}
+
+// Stops watching input, before its owner closes it and the number is reused
+void EventLoop::release(int input) {
+  if (input != -1 && input == input_fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, nullptr);
+    input_fd = -1;
+  }
+}
+
+// Handles whatever is already pending, without sleeping
+void EventLoop::poll() {
+  struct epoll_event events[EVENTS_MAX];
+  int count = epoll_wait(epoll_fd, events, EVENTS_MAX, 0);
+  for (int i = 0; i < count; i++) {
+    if (events[i].data.fd != input_fd) {
+      dispatch(events[i].data.fd);
+    }
+  }
+}
+/*** EventLoop class END ***/
@@ -0,0 +1,50 @@
+#ifndef SMASH_EVENTS_H_
+#define SMASH_EVENTS_H_
+
+#include <signal.h>
+#include <string>
+#include <vector>
+
+#define EVENTS_MAX (8)
+
+/**
+* The one place smash sleeps. SIGCHLD, SIGINT, SIGTSTP and SIGALRM stay blocked
+* and are read from a signalfd, and timeouts expire on the timer queue's timerfd;
+* both are multiplexed with epoll, optionally together with an input fd. Their
+* handlers (signals.h) therefore always run on the main flow, between commands
+* or while smash waits, never in signal context. Output that smash's own builtins
+* produced for a pipe is written from here too, as the reader makes room for it.
+*/
+class EventLoop {
+private:
+  class Feeder {
+  public:
+    int fd;
+    std::string data;
+    size_t written;
+  };
+  std::vector<Feeder> feeders;  // pipes smash still writes into
+  int epoll_fd;
+  int signal_fd;
+  int timer_fd;
+  int input_fd;   // registered while wait() is asked to watch it
+  sigset_t mask;
+  sigset_t orig_mask;  // what smash had blocked before init()
+  bool watch(int fd);
+  bool listen(int timer_fd);
+  void dispatch(int fd);
+  bool pump(Feeder& feeder);
+public:
+  EventLoop();
+  ~EventLoop();
+  EventLoop(EventLoop const&) = delete;
+  void operator=(EventLoop const&) = delete;
+  bool init(int timer_fd);
+  void reset(int timer_fd);
+  bool wait(int input = -1);
+  void release(int input);
+  void feed(int fd, std::string&& data);
+  void poll();
+};
+
+#endif //SMASH_EVENTS_H_
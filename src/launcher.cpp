@@ -0,0 +1,457 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <spawn.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include "launcher.h"
+#include "output.h"
+
+using namespace std;
+
+#define SYSCALL_ERROR(CMD)  "smash error: " CMD " failed"
+#define EXECV               "execv"
+#define FORK                "fork"
+#define VFORK               "vfork"
+#define CLONE               "clone"
+#define BASH_PATH           "/bin/bash"
+#define DEFAULT_PATH        "/bin:/usr/bin"
+#define CLONE_STACK_SIZE    (64 * 1024)
+
+static const char* BACKEND_NAMES[] = {"fork", "vfork", "posix_spawn", "clone"};
+
+// Only async-signal-safe calls from here on: the child may share our memory
+static void _childFail(const char* syscall) {
+  const char* err = strerror(errno);
+  char msg[256];
+  size_t len = 0;
+  const char* parts[] = {"smash error: ", syscall, " failed: ", err, "\n"};
+  for (const char* part : parts) {
+    size_t part_len = strlen(part);
+    if (len + part_len >= sizeof(msg)) {
+      break;
+    }
+    memcpy(msg + len, part, part_len);
+    len += part_len;
+  }
+  if (write(STDERR_FILENO, msg, len) < 0) {
+    // nothing left to report to
+  }
+  _exit(127);
+}
+
+static void _runChild(const SpawnSpec& spec) {
+  if (spec.pgid >= 0 && setpgid(0, spec.pgid) == -1) {
+    _childFail("setpgid");
+  }
+  for (int sig : spec.default_signals) {
+    signal(sig, SIG_DFL);
+  }
+  sigset_t empty;
+  sigemptyset(&empty);
+  sigprocmask(SIG_SETMASK, &empty, nullptr);
+  for (const SpawnSpec::FdAction& action : spec.fd_actions) {
+    if (action.type == SpawnSpec::FdAction::DUP) {
+      if (dup2(action.src_fd, action.fd) == -1) {
+        _childFail("dup");
+      }
+    }
+    else if (action.type == SpawnSpec::FdAction::OPEN) {
+      int fd = open(action.path.c_str(), action.flags, action.mode);
+      if (fd == -1) {
+        _childFail("open");
+      }
+      if (fd != action.fd) {
+        if (dup2(fd, action.fd) == -1) {
+          _childFail("dup");
+        }
+        close(fd);
+      }
+    }
+    else {
+      close(action.fd);
+    }
+  }
+  execv(spec.path.c_str(), spec.argv.data());
+  _childFail(EXECV);
+}
+
+static int _cloneChild(void* arg) {
+  _runChild(*static_cast<const SpawnSpec*>(arg));
+  return 0;
+}
+
+static bool _isExecutable(const char* path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+
+
+/*** SpawnSpec class ***/
+SpawnSpec::SpawnSpec() : pgid(-1), default_signals({SIGINT, SIGTSTP, SIGALRM, SIGCHLD, SIGPIPE}) {}
+
+void SpawnSpec::setArgs(const string& exec_path, char** args) {
+  path = exec_path;
+  argv.clear();
+  for (int i = 0; args[i] != nullptr; i++) {
+    argv.push_back(args[i]);
+  }
+  argv.push_back(nullptr);
+}
+
+void SpawnSpec::setBashLine(const char* cmd_line) {
+  bash_line = cmd_line;
+  path = BASH_PATH;
+  argv = {const_cast<char*>(BASH_PATH), const_cast<char*>("-c"), &bash_line[0], nullptr};
+}
+
+void SpawnSpec::addDup(int src_fd, int fd) {
+  fd_actions.push_back({FdAction::DUP, fd, src_fd, "", 0, 0});
+}
+
+void SpawnSpec::addOpen(int fd, const char* file, int flags, mode_t mode) {
+  fd_actions.push_back({FdAction::OPEN, fd, -1, file, flags, mode});
+}
+
+void SpawnSpec::addClose(int fd) {
+  fd_actions.push_back({FdAction::CLOSE, fd, -1, "", 0, 0});
+}
+/*** SpawnSpec class END ***/
+
+
+
+
+/*** Launcher class ***/
+Launcher::Launcher() : backend(SPAWN_FORK), spawns(0), spawn_nsecs(0) {}
+
+Launcher::~Launcher() {}
+
+/**
+* Starts spec.path in a new process using the selected backend.
+* Returns the child's pid, or -1 after printing an error.
+*/
+pid_t Launcher::spawn(const SpawnSpec& spec, int* pidfd) {
+  // the child must not inherit, or miss, text still sitting in our buffers
+  flushOutput();
+  if (pidfd != nullptr) {
+    *pidfd = -1;
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid;
+  switch (backend) {
+    case SPAWN_VFORK:
+      pid = spawnFork(spec, true);
+      break;
+    case SPAWN_POSIX_SPAWN:
+      pid = spawnPosix(spec);
+      break;
+    case SPAWN_CLONE:
+      pid = spawnClone(spec, pidfd);
+      break;
+    default:
+      pid = spawnFork(spec, false);
+      break;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (pid > 0) {
+    // the parent sets the group too, so it exists before a later pipeline stage joins it
+    if (spec.pgid >= 0) {
+      setpgid(pid, spec.pgid);
+    }
+    spawns++;
+    spawn_nsecs += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+  }
+  return pid;
+}
+
+pid_t Launcher::spawnFork(const SpawnSpec& spec, bool use_vfork) {
+  // keep our handlers from running in the child before it resets them
+  sigset_t all, old;
+  sigfillset(&all);
+  sigprocmask(SIG_SETMASK, &all, &old);
+  pid_t pid = use_vfork ? vfork() : fork();
+  if (pid == 0) {
+    _runChild(spec);
+  }
+  int saved_errno = errno;
+  sigprocmask(SIG_SETMASK, &old, nullptr);
+  if (pid == -1) {
+    errno = saved_errno;
+    perror(use_vfork ? SYSCALL_ERROR(VFORK) : SYSCALL_ERROR(FORK));
+  }
+  return pid;
+}
+
+pid_t Launcher::spawnPosix(const SpawnSpec& spec) {
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_init(&attr);
+  posix_spawn_file_actions_init(&actions);
+
+  short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+  if (spec.pgid >= 0) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, spec.pgid);
+  }
+  sigset_t sigdef, empty;
+  sigemptyset(&sigdef);
+  for (int sig : spec.default_signals) {
+    sigaddset(&sigdef, sig);
+  }
+  sigemptyset(&empty);
+  posix_spawnattr_setsigdefault(&attr, &sigdef);
+  posix_spawnattr_setsigmask(&attr, &empty);
+  posix_spawnattr_setflags(&attr, flags);
+
+  for (const SpawnSpec::FdAction& action : spec.fd_actions) {
+    if (action.type == SpawnSpec::FdAction::DUP) {
+      posix_spawn_file_actions_adddup2(&actions, action.src_fd, action.fd);
+    }
+    else if (action.type == SpawnSpec::FdAction::OPEN) {
+      posix_spawn_file_actions_addopen(&actions, action.fd, action.path.c_str(), action.flags, action.mode);
+    }
+    else {
+      posix_spawn_file_actions_addclose(&actions, action.fd);
+    }
+  }
+
+  pid_t pid;
+  int err = posix_spawn(&pid, spec.path.c_str(), &actions, &attr, spec.argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    perror(SYSCALL_ERROR(EXECV));
+    return -1;
+  }
+  return pid;
+}
+
+/**
+* clone(CLONE_VM | CLONE_VFORK) shares our memory like vfork but runs the child
+* on its own stack, and CLONE_PIDFD hands back a pidfd for free.
+*/
+pid_t Launcher::spawnClone(const SpawnSpec& spec, int* pidfd) {
+  // the parent is suspended until the child execs, so one stack is enough
+  static char* stack = nullptr;
+  if (stack == nullptr) {
+    void* mem = mmap(nullptr, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mem == MAP_FAILED) {
+      perror(SYSCALL_ERROR(CLONE));
+      return -1;
+    }
+    stack = static_cast<char*>(mem);
+  }
+  sigset_t all, old;
+  sigfillset(&all);
+  sigprocmask(SIG_SETMASK, &all, &old);
+  int fd = -1;
+  pid_t pid = clone(_cloneChild, stack + CLONE_STACK_SIZE, CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD,
+                    const_cast<SpawnSpec*>(&spec), &fd);
+  int saved_errno = errno;
+  sigprocmask(SIG_SETMASK, &old, nullptr);
+  if (pid == -1) {
+    errno = saved_errno;
+    perror(SYSCALL_ERROR(CLONE));
+    return -1;
+  }
+  if (pidfd != nullptr) {
+    *pidfd = fd;
+  }
+  else {
+    close(fd);
+  }
+  return pid;
+}
+
+/**
+* Forks a copy of smash for children that run shell code instead of exec'ing,
+* so it can't go through the vfork-like backends.
+*/
+pid_t Launcher::forkShell(pid_t pgid) {
+  flushOutput();
+  pid_t pid = fork();
+  if (pid != -1 && pgid >= 0) {
+    setpgid((pid == 0) ? 0 : pid, pgid);
+  }
+  if (pid == -1) {
+    perror(SYSCALL_ERROR(FORK));
+  }
+  return pid;
+}
+
+bool Launcher::setBackend(const char* name) {
+  for (int i = SPAWN_FORK; i <= SPAWN_CLONE; i++) {
+    if (strcmp(name, BACKEND_NAMES[i]) == 0) {
+      backend = static_cast<SpawnBackend>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* Launcher::getBackendName() {
+  return BACKEND_NAMES[backend];
+}
+
+long Launcher::getSpawns() {
+  return spawns;
+}
+
+double Launcher::getAvgSpawnUsecs() {
+  return (spawns == 0) ? 0 : (spawn_nsecs / 1000.0) / spawns;
+}
+
+// Resolves cmd to an executable path the way execvp would, without spawning anything
+bool Launcher::resolve(const char* cmd, string& path) {
+  if (strchr(cmd, '/') != nullptr) {
+    path = cmd;
+    return _isExecutable(cmd);
+  }
+  return path_cache.lookup(cmd, path);
+}
+/*** Launcher class END ***/
+
+
+
+
+/*** PathCache class ***/
+PathCache::PathCache() : hits(0), misses(0) {}
+
+// Drops the whole table if PATH is not the one it was built for
+void PathCache::syncPath() {
+  const char* env_path = getenv("PATH");
+  string current = (env_path != nullptr) ? env_path : DEFAULT_PATH;
+  if (current == path_env && !dirs.empty()) {
+    return;
+  }
+  table.clear();
+  dirs.clear();
+  path_env = current;
+  size_t start = 0;
+  while (start <= path_env.size()) {
+    size_t end = path_env.find(':', start);
+    if (end == string::npos) {
+      end = path_env.size();
+    }
+    Dir dir;
+    dir.name = (end == start) ? "." : path_env.substr(start, end - start);
+    dir.mtime = {0, 0};
+    dirs.push_back(dir);
+    start = end + 1;
+  }
+}
+
+// Records the directory's current mtime and reports whether it moved since last time
+bool PathCache::dirChanged(size_t dir) {
+  struct stat st;
+  struct timespec mtime = {0, 0};
+  if (stat(dirs[dir].name.c_str(), &st) == 0) {
+    mtime = st.st_mtim;
+  }
+  bool changed = (mtime.tv_sec != dirs[dir].mtime.tv_sec || mtime.tv_nsec != dirs[dir].mtime.tv_nsec);
+  dirs[dir].mtime = mtime;
+  return changed;
+}
+
+// Forgets every entry from dir or a later one, which a change in dir may have removed or shadowed
+void PathCache::dropFrom(size_t dir) {
+  for (auto it = table.begin(); it != table.end(); ) {
+    it = (it->second.dir >= dir) ? table.erase(it) : ++it;
+  }
+}
+
+// Whether no directory up to and including the entry's own changed since it was resolved
+bool PathCache::fresh(const Entry& entry) {
+  size_t dir = entry.dir;
+  struct timespec mtime = entry.mtime;
+  for (size_t i = 0; i <= dir; i++) {
+    if (dirChanged(i)) {
+      dropFrom(i);
+      return false;
+    }
+  }
+  return mtime.tv_sec == dirs[dir].mtime.tv_sec && mtime.tv_nsec == dirs[dir].mtime.tv_nsec;
+}
+
+// Each directory is looked at before it is searched, so a later change to it always shows
+bool PathCache::search(const char* cmd, Entry& entry) {
+  for (size_t i = 0; i < dirs.size(); i++) {
+    if (dirChanged(i)) {
+      dropFrom(i);
+    }
+    string path = dirs[i].name + "/" + cmd;
+    if (_isExecutable(path.c_str())) {
+      entry.path = path;
+      entry.dir = i;
+      entry.mtime = dirs[i].mtime;
+      entry.hits = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PathCache::lookup(const char* cmd, string& path) {
+  syncPath();
+  auto iter = table.find(cmd);
+  if (iter != table.end() && fresh(iter->second)) {
+    hits++;
+    iter->second.hits++;
+    path = iter->second.path;
+    return true;
+  }
+  misses++;
+  Entry entry;
+  if (!search(cmd, entry)) {
+    return false;
+  }
+  entry.hits = 1;
+  path = entry.path;
+  table[cmd] = entry;
+  return true;
+}
+
+// Resolves cmd into the table without counting it as a use
+bool PathCache::warm(const char* cmd) {
+  syncPath();
+  Entry entry;
+  if (!search(cmd, entry)) {
+    return false;
+  }
+  table[cmd] = entry;
+  return true;
+}
+
+void PathCache::clear() {
+  table.clear();
+  dirs.clear();
+  hits = 0;
+  misses = 0;
+}
+
+long PathCache::getHits() {
+  return hits;
+}
+
+long PathCache::getMisses() {
+  return misses;
+}
+
+vector<pair<string, PathCache::Entry>> PathCache::getEntries() {
+  vector<pair<string, Entry>> entries(table.begin(), table.end());
+  sort(entries.begin(), entries.end(), [](const pair<string, Entry>& a, const pair<string, Entry>& b) {
+    return a.first < b.first;
+  });
+  return entries;
+}
+/*** PathCache class END ***/
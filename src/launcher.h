@@ -0,0 +1,114 @@
+#ifndef SMASH_LAUNCHER_H_
+#define SMASH_LAUNCHER_H_
+
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+enum SpawnBackend {
+  SPAWN_FORK,
+  SPAWN_VFORK,
+  SPAWN_POSIX_SPAWN,
+  SPAWN_CLONE
+};
+
+/**
+* Everything the child needs between fork and exec. The launcher applies it
+* either through posix_spawn attributes or from the child of a fork-like call,
+* so callers never run their own code in the child.
+*/
+class SpawnSpec {
+public:
+  class FdAction {
+  public:
+    enum Type { DUP, OPEN, CLOSE };
+    Type type;
+    int fd;
+    int src_fd;
+    std::string path;
+    int flags;
+    mode_t mode;
+  };
+
+  std::string path;
+  std::vector<char*> argv;
+  pid_t pgid;                        // -1 keeps smash's group, 0 starts a new one
+  std::vector<FdAction> fd_actions;
+  std::vector<int> default_signals;  // reset to SIG_DFL in the child
+
+  SpawnSpec();
+  void setArgs(const std::string& exec_path, char** args);
+  void setBashLine(const char* cmd_line);
+  void addDup(int src_fd, int fd);
+  void addOpen(int fd, const char* file, int flags, mode_t mode);
+  void addClose(int fd);
+
+private:
+  std::string bash_line;
+};
+
+/**
+* Remembers where each command name was found on PATH. The table is dropped
+* whenever PATH changes. An entry is re-resolved once the mtime of the directory
+* it came from, or of any directory before it on PATH, changes: the binary may be
+* gone, or a new one may shadow it.
+*/
+class PathCache {
+public:
+  class Entry {
+  public:
+    std::string path;
+    size_t dir;
+    struct timespec mtime;  // of dir when it was resolved
+    long hits;
+  };
+private:
+  class Dir {
+  public:
+    std::string name;
+    struct timespec mtime;
+  };
+  std::string path_env;
+  std::vector<Dir> dirs;
+  std::unordered_map<std::string, Entry> table;
+  long hits;
+  long misses;
+  void syncPath();
+  bool dirChanged(size_t dir);
+  void dropFrom(size_t dir);
+  bool fresh(const Entry& entry);
+  bool search(const char* cmd, Entry& entry);
+public:
+  PathCache();
+  bool lookup(const char* cmd, std::string& path);
+  bool warm(const char* cmd);
+  void clear();
+  long getHits();
+  long getMisses();
+  std::vector<std::pair<std::string, Entry>> getEntries();
+};
+
+class Launcher {
+private:
+  SpawnBackend backend;
+  long spawns;
+  long long spawn_nsecs;
+  pid_t spawnFork(const SpawnSpec& spec, bool use_vfork);
+  pid_t spawnPosix(const SpawnSpec& spec);
+  pid_t spawnClone(const SpawnSpec& spec, int* pidfd);
+public:
+  Launcher();
+  ~Launcher();
+  pid_t spawn(const SpawnSpec& spec, int* pidfd = nullptr);
+  pid_t forkShell(pid_t pgid);
+  bool setBackend(const char* name);
+  const char* getBackendName();
+  PathCache path_cache;
+  long getSpawns();
+  double getAvgSpawnUsecs();
+  bool resolve(const char* cmd, std::string& path);
+};
+
+#endif //SMASH_LAUNCHER_H_
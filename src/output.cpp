@@ -0,0 +1,119 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <iostream>
+#include "output.h"
+
+using namespace std;
+
+// Never freed: std::cout may still flush through them while statics are destroyed
+static OutBuf* out_buf = new OutBuf(STDOUT_FILENO);
+static OutBuf* err_buf = new OutBuf(STDERR_FILENO);
+
+// write(2) all of it, retrying short writes; on a dead fd the text is dropped
+static bool _writeFd(int fd, const char* str, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, str, len);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    str += written;
+    len -= written;
+  }
+  return true;
+}
+
+
+
+/*** OutBuf class ***/
+OutBuf::OutBuf(int fd) : fd(fd), unbuffered(false), partner(nullptr) {
+  setp(buf, buf + sizeof(buf));
+}
+
+bool OutBuf::pending() {
+  return pptr() != pbase();
+}
+
+// Everything the other stream buffered was written before what comes next here
+void OutBuf::switchTo() {
+  if (partner != nullptr && partner->pending()) {
+    partner->flush();
+  }
+}
+
+bool OutBuf::flush() {
+  bool ok = _writeFd(fd, pbase(), pptr() - pbase());
+  setp(buf, buf + sizeof(buf));
+  return ok;
+}
+
+OutBuf::int_type OutBuf::overflow(int_type c) {
+  switchTo();
+  if (!flush()) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+streamsize OutBuf::xsputn(const char* s, streamsize n) {
+  switchTo();
+  if (n > epptr() - pptr()) {
+    if (!flush()) {
+      return 0;
+    }
+    // bigger than the whole buffer: no point copying it first
+    if (n >= (streamsize)sizeof(buf)) {
+      return _writeFd(fd, s, n) ? n : 0;
+    }
+  }
+  memcpy(pptr(), s, n);
+  pbump(n);
+  if (unbuffered && !flush()) {
+    return 0;
+  }
+  return n;
+}
+
+// std::flush and friends: empty both streams, the partner's older text first
+int OutBuf::sync() {
+  switchTo();
+  return flush() ? 0 : -1;
+}
+
+void OutBuf::setPartner(OutBuf* other) {
+  this->partner = other;
+}
+
+void OutBuf::setUnbuffered(bool val) {
+  this->unbuffered = val;
+}
+/*** OutBuf class END ***/
+
+
+
+/**
+* Routes std::cout and std::cerr through smash's buffers. With unbuffered, every
+* write goes out at once, the way stdio behaved with setbuf(stdout, NULL).
+*/
+void installOutput(bool unbuffered) {
+  out_buf->setPartner(err_buf);
+  err_buf->setPartner(out_buf);
+  out_buf->setUnbuffered(unbuffered);
+  err_buf->setUnbuffered(unbuffered);
+  std::cout.rdbuf(out_buf);
+  std::cerr.rdbuf(err_buf);
+  std::cerr.unsetf(std::ios::unitbuf);
+  atexit(flushOutput);
+}
+
+void flushOutput() {
+  std::cout.flush();
+}
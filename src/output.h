@@ -0,0 +1,36 @@
+#ifndef SMASH_OUTPUT_H_
+#define SMASH_OUTPUT_H_
+
+#include <streambuf>
+
+#define OUTPUT_BUFFER_SIZE (8 * 1024)
+
+/**
+* Shell-owned buffer behind std::cout or std::cerr. Text reaches the fd only at
+* flush points (prompt, fork/exec, waiting on a child, a full buffer, exit).
+* Writing to one stream first flushes its partner, so stdout and stderr keep
+* their relative order when they share a terminal or file.
+*/
+class OutBuf : public std::streambuf {
+private:
+  int fd;
+  bool unbuffered;
+  OutBuf* partner;
+  char buf[OUTPUT_BUFFER_SIZE];
+  bool pending();
+  void switchTo();
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+  int sync() override;
+public:
+  OutBuf(int fd);
+  bool flush();
+  void setPartner(OutBuf* other);
+  void setUnbuffered(bool val);
+};
+
+void installOutput(bool unbuffered);
+void flushOutput();
+
+#endif //SMASH_OUTPUT_H_
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+#include "parser.h"
+
+using namespace std;
+
+static const char* WHITESPACE = " \n\r\t\f\v";
+
+static bool _isSpace(char c) {
+  return c != '\0' && strchr(WHITESPACE, c) != nullptr;
+}
+
+// A word ends at whitespace and at the pipe and redirection operators
+static bool _endsWord(string_view line, size_t pos) {
+  char c = line[pos];
+  return _isSpace(c) || c == '|' || c == '<' || c == '>' || (c == '&' && pos + 1 < line.size() && line[pos + 1] == '>');
+}
+
+// Where a redirection operator starts, if one does at pos: after an fd number, or right at pos
+static size_t _operatorAt(string_view line, size_t pos) {
+  size_t op = pos;
+  while (op < line.size() && line[op] >= '0' && line[op] <= '9') {
+    op++;
+  }
+  if (op < line.size() && (line[op] == '<' || line[op] == '>')) {
+    return op;
+  }
+  if (op == pos && op + 1 < line.size() && line[op] == '&' && line[op + 1] == '>') {
+    return op;
+  }
+  return string_view::npos;
+}
+
+static int _fdNumber(string_view digits) {
+  int fd = 0;
+  for (char c : digits) {
+    fd = (fd < REDIRECT_FD_LIMIT) ? fd * 10 + (c - '0') : fd;
+  }
+  return fd;
+}
+
+string_view trimView(string_view str) {
+  size_t start = str.find_first_not_of(WHITESPACE);
+  if (start == string_view::npos) {
+    return string_view();
+  }
+  size_t end = str.find_last_not_of(WHITESPACE);
+  return str.substr(start, end - start + 1);
+}
+
+
+
+/*** Arena class ***/
+Arena::Arena() : block(0), used(0) {}
+
+Arena::~Arena() {
+  for (Block& b : blocks) {
+    free(b.mem);
+  }
+}
+
+void* Arena::alloc(size_t size) {
+  size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+  while (block < blocks.size() && used + size > blocks[block].size) {
+    block++;
+    used = 0;
+  }
+  if (block == blocks.size()) {
+    Block b = {nullptr, (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE};
+    b.mem = (char*)malloc(b.size);
+    if (b.mem == nullptr) {
+      throw std::bad_alloc();
+    }
+    blocks.push_back(b);
+  }
+  void* mem = blocks[block].mem + used;
+  used += size;
+  return mem;
+}
+
+char* Arena::copy(string_view str) {
+  char* mem = (char*)alloc(str.size() + 1);
+  memcpy(mem, str.data(), str.size());
+  mem[str.size()] = '\0';
+  return mem;
+}
+
+Arena::Mark Arena::mark() {
+  return {block, used};
+}
+
+void Arena::release(const Mark& mark) {
+  block = mark.block;
+  used = mark.used;
+}
+/*** Arena class END ***/
+
+
+
+
+/*** CommandLine class ***/
+// A line made of just the i-th command, e.g. to run one stage of a pipeline
+CommandLine CommandLine::stage(int i) const {
+  CommandLine line = {commands[i].text, commands[i].text, commands + i, 1, false};
+  return line;
+}
+/*** CommandLine class END ***/
+
+
+
+
+/*** Parser class ***/
+void Parser::endCommand(string_view line, size_t start, size_t end, bool pipe_stderr) {
+  SimpleCommand cmd;
+  cmd.text = trimView(line.substr(start, end - start));
+  cmd.argc = words.size();
+  cmd.argv = (char**)arena.alloc((words.size() + 1) * sizeof(char*));
+  for (size_t i = 0; i < words.size(); i++) {
+    cmd.argv[i] = words[i];
+  }
+  cmd.argv[cmd.argc] = nullptr;
+  cmd.redir_count = redirs.size();
+  cmd.redirs = (Redirection*)arena.alloc(redirs.size() * sizeof(Redirection));
+  for (size_t i = 0; i < redirs.size(); i++) {
+    cmd.redirs[i] = redirs[i];
+  }
+  cmd.pipe_stderr = pipe_stderr;
+  commands.push_back(cmd);
+  words.clear();
+  redirs.clear();
+}
+
+/**
+* Scans the redirection whose fd number starts at pos and operator at op, and
+* returns where it ends. "N>&M" with a number M duplicates M; "&>file" and
+* ">&file" send both stdout and stderr to file.
+*/
+size_t Parser::scanRedirect(string_view line, size_t pos, size_t op) {
+  bool numbered = (op > pos);
+  int fd = _fdNumber(line.substr(pos, op - pos));
+  bool both = (line[op] == '&');
+  if (both) {
+    op++;
+  }
+  char kind = line[op++];
+  bool append = (kind == '>' && op < line.size() && line[op] == '>');
+  if (append) {
+    op++;
+  }
+  bool dup = (!both && op < line.size() && line[op] == '&');
+  if (dup) {
+    op++;
+  }
+
+  Redirection redir = {numbered ? fd : (kind == '<') ? STDIN_FILENO : STDOUT_FILENO, -1, "", 0};
+  while (op < line.size() && _isSpace(line[op])) {
+    op++;
+  }
+  size_t end = op;
+  while (end < line.size() && !_endsWord(line, end)) {
+    end++;
+  }
+  string_view word = line.substr(op, end - op);
+
+  if (dup && !word.empty() && word.find_first_not_of("0123456789") == string_view::npos) {
+    redir.src_fd = _fdNumber(word);
+    redirs.push_back(redir);
+    return end;
+  }
+  // ">&file" without an fd number is "&>file"
+  both = both || (dup && kind == '>' && !numbered);
+  redir.file = arena.copy(word);
+  if (kind == '<') {
+    redir.flags = O_RDONLY;
+  }
+  else {
+    redir.flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+  }
+  redirs.push_back(redir);
+  if (both) {
+    redirs.push_back({STDERR_FILENO, STDOUT_FILENO, "", 0});
+  }
+  return end;
+}
+
+/**
+* Words are split on whitespace only; quoting is left to bash. '|', '|&' and the
+* redirection operators end a word wherever they appear, and a trailing '&' runs
+* the line in the background. A redirection takes the word after its operator and
+* belongs to the command it appears in, so each stage of a pipeline has its own.
+*/
+const CommandLine* Parser::parse(string_view line) {
+  words.clear();
+  redirs.clear();
+  commands.clear();
+  CommandLine* parsed = (CommandLine*)arena.alloc(sizeof(CommandLine));
+  parsed->text = line;
+  parsed->body = trimView(line);
+  parsed->background = (!parsed->body.empty() && parsed->body.back() == '&');
+  if (parsed->background) {
+    parsed->body = trimView(parsed->body.substr(0, parsed->body.size() - 1));
+  }
+
+  string_view body = parsed->body;
+  size_t pos = 0;
+  size_t start = 0;
+  while (pos < body.size()) {
+    char c = body[pos];
+    if (_isSpace(c)) {
+      pos++;
+    }
+    else if (c == '|') {
+      bool pipe_stderr = (pos + 1 < body.size() && body[pos + 1] == '&');
+      endCommand(body, start, pos, pipe_stderr);
+      pos += pipe_stderr ? 2 : 1;
+      start = pos;
+    }
+    else if (size_t op = _operatorAt(body, pos); op != string_view::npos) {
+      pos = scanRedirect(body, pos, op);
+    }
+    else {
+      size_t end = pos;
+      while (end < body.size() && !_endsWord(body, end)) {
+        end++;
+      }
+      words.push_back(arena.copy(body.substr(pos, end - pos)));
+      pos = end;
+    }
+  }
+  endCommand(body, start, pos, false);
+
+  parsed->count = commands.size();
+  parsed->commands = (SimpleCommand*)arena.alloc(commands.size() * sizeof(SimpleCommand));
+  for (size_t i = 0; i < commands.size(); i++) {
+    parsed->commands[i] = commands[i];
+  }
+  commands.clear();
+  return parsed;
+}
+
+Arena::Mark Parser::mark() {
+  return arena.mark();
+}
+
+void Parser::release(const Arena::Mark& mark) {
+  arena.release(mark);
+}
+/*** Parser class END ***/
@@ -0,0 +1,101 @@
+#ifndef SMASH_PARSER_H_
+#define SMASH_PARSER_H_
+
+#include <stddef.h>
+#include <string_view>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+/**
+* Bump allocator for everything parsed out of a line. Blocks are kept once
+* allocated, and memory is given back by rewinding to a mark, so steady-state
+* parsing never calls malloc.
+*/
+class Arena {
+private:
+  class Block {
+  public:
+    char* mem;
+    size_t size;
+  };
+  std::vector<Block> blocks;
+  size_t block;  // the block being filled
+  size_t used;   // bytes handed out from it
+public:
+  class Mark {
+  public:
+    size_t block;
+    size_t used;
+  };
+  Arena();
+  ~Arena();
+  Arena(Arena const&) = delete;
+  void operator=(Arena const&) = delete;
+  void* alloc(size_t size);
+  char* copy(std::string_view str);
+  Mark mark();
+  void release(const Mark& mark);
+};
+
+#define REDIRECT_FD_LIMIT (100000)  // fd numbers stop growing here; dup2 rejects them anyway
+
+/**
+* One "[N]<file", "[N]>file", "[N]>>file", "[N]>&M" or half of an "&>file".
+*/
+class Redirection {
+public:
+  int fd;            // the command's fd it sets up
+  int src_fd;        // M of "N>&M", or -1 to open file
+  const char* file;  // in the arena; empty if no word followed the operator
+  int flags;         // open(2) flags for file
+};
+
+/**
+* One command of a pipeline. The views and argv point into the line and the
+* arena, so they are only valid while that line executes.
+*/
+class SimpleCommand {
+public:
+  std::string_view text;  // the command's slice of the line, trimmed, redirections included
+  char** argv;            // NULL-terminated
+  int argc;
+  Redirection* redirs;    // applied in order, after the pipes
+  int redir_count;
+  bool pipe_stderr;       // "|&" follows: its stderr, not stdout, feeds the next command
+};
+
+/**
+* A parsed line: "cmd [| cmd | ...] [&]", where each cmd may carry redirections.
+*/
+class CommandLine {
+public:
+  std::string_view text;      // the whole line as typed
+  std::string_view body;      // text trimmed, without the trailing '&'
+  SimpleCommand* commands;    // at least one, empty ones have argc == 0
+  int count;
+  bool background;
+  CommandLine stage(int i) const;
+};
+
+/**
+* Splits lines into CommandLines in one pass over the characters.
+*/
+class Parser {
+private:
+  Arena arena;
+  std::vector<char*> words;              // scratch for the command being scanned
+  std::vector<Redirection> redirs;       // scratch for the command being scanned
+  std::vector<SimpleCommand> commands;   // scratch for the pipeline being scanned
+  void endCommand(std::string_view line, size_t start, size_t end, bool pipe_stderr);
+  size_t scanRedirect(std::string_view line, size_t pos, size_t op);
+public:
+  Parser() {}
+  const CommandLine* parse(std::string_view line);
+  Arena::Mark mark();
+  void release(const Arena::Mark& mark);
+};
+
+std::string_view trimView(std::string_view str);
+
+#endif //SMASH_PARSER_H_
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <new>
+#include "pool.h"
+
+using namespace std;
+
+static long heap_allocs = 0;
+static long heap_frees = 0;
+
+// Counted replacements for the global allocation functions; the array forms forward here
+void* operator new(size_t size) {
+  heap_allocs++;
+  void* mem = malloc(size ? size : 1);
+  if (mem == nullptr) {
+    throw std::bad_alloc();
+  }
+  return mem;
+}
+
+void operator delete(void* mem) noexcept {
+  if (mem != nullptr) {
+    heap_frees++;
+  }
+  free(mem);
+}
+
+void operator delete(void* mem, size_t) noexcept {
+  operator delete(mem);
+}
+
+HeapStats heapStats() {
+  return {heap_allocs, heap_frees};
+}
+
+
+
+/*** Pool class ***/
+Pool::Pool(size_t block_size) : free_list(nullptr) {
+  size_t align = alignof(max_align_t);
+  this->block_size = (block_size < sizeof(FreeBlock)) ? sizeof(FreeBlock) : block_size;
+  this->block_size = (this->block_size + align - 1) & ~(align - 1);
+}
+
+Pool::~Pool() {
+  for (void* chunk : chunks) {
+    ::operator delete(chunk);
+  }
+}
+
+void* Pool::alloc() {
+  if (free_list == nullptr) {
+    // room first, so the chunk can't be lost once it is allocated
+    chunks.reserve(chunks.size() + 1);
+    char* chunk = (char*)::operator new(block_size * POOL_CHUNK_BLOCKS);
+    chunks.push_back(chunk);
+    for (int i = POOL_CHUNK_BLOCKS - 1; i >= 0; i--) {
+      release(chunk + i * block_size);
+    }
+  }
+  FreeBlock* block = free_list;
+  free_list = block->next;
+  return block;
+}
+
+void Pool::release(void* block) {
+  FreeBlock* freed = static_cast<FreeBlock*>(block);
+  freed->next = free_list;
+  free_list = freed;
+}
+/*** Pool class END ***/
+
+
+
+// Built on first use, so a Command made during static initialization still finds them
+static Pool& _commandPool(size_t size) {
+  static Pool* pools[COMMAND_POOL_CLASSES] = {};
+  size_t index = (size - 1) / COMMAND_POOL_GRAIN;
+  if (pools[index] == nullptr) {
+    pools[index] = new Pool((index + 1) * COMMAND_POOL_GRAIN);
+  }
+  return *pools[index];
+}
+
+void* poolAlloc(size_t size) {
+  if (size == 0 || size > COMMAND_POOL_GRAIN * COMMAND_POOL_CLASSES) {
+    return ::operator new(size);
+  }
+  return _commandPool(size).alloc();
+}
+
+void poolFree(void* mem, size_t size) {
+  if (mem == nullptr) {
+    return;
+  }
+  if (size == 0 || size > COMMAND_POOL_GRAIN * COMMAND_POOL_CLASSES) {
+    ::operator delete(mem);
+    return;
+  }
+  _commandPool(size).release(mem);
+}
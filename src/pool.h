@@ -0,0 +1,78 @@
+#ifndef SMASH_POOL_H_
+#define SMASH_POOL_H_
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+#define POOL_CHUNK_BLOCKS (64)
+#define COMMAND_POOL_GRAIN (64)   // Command size classes are multiples of this
+#define COMMAND_POOL_CLASSES (8)  // up to 512 bytes; anything bigger goes to the heap
+
+/**
+* Fixed-size blocks carved from chunks of POOL_CHUNK_BLOCKS. A freed block is
+* linked into the free list through its own first bytes and handed out again
+* first, so once a session has warmed up alloc and free are a pointer swap.
+* Chunks are only given back when the pool goes away.
+*/
+class Pool {
+private:
+  class FreeBlock {
+  public:
+    FreeBlock* next;
+  };
+  size_t block_size;
+  FreeBlock* free_list;
+  std::vector<void*> chunks;
+public:
+  explicit Pool(size_t block_size);
+  ~Pool();
+  Pool(Pool const&) = delete;
+  void operator=(Pool const&) = delete;
+  void* alloc();
+  void release(void* block);
+};
+
+/**
+* A Pool sized for T that constructs and destroys its objects in place.
+*/
+template <typename T>
+class ObjectPool {
+private:
+  Pool pool;
+public:
+  ObjectPool() : pool(sizeof(T)) {}
+  template <typename... Args>
+  T* create(Args&&... args) {
+    void* mem = pool.alloc();
+    try {
+      return new (mem) T(std::forward<Args>(args)...);
+    } catch (...) {
+      pool.release(mem);
+      throw;
+    }
+  }
+  void destroy(T* obj) {
+    obj->~T();
+    pool.release(obj);
+  }
+};
+
+// Size-class pools behind Command's operator new and delete
+void* poolAlloc(size_t size);
+void poolFree(void* mem, size_t size);
+
+/**
+* Calls to the global operator new and delete since smash started. Every
+* std::string, vector or node that outgrows its inline storage shows up here.
+*/
+class HeapStats {
+public:
+  long allocs;
+  long frees;
+};
+
+HeapStats heapStats();
+
+#endif //SMASH_POOL_H_
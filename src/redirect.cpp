@@ -0,0 +1,109 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include "redirect.h"
+
+using namespace std;
+
+#define REDIRECT_ERROR(CMD) "smash error: " CMD " failed: "
+#define OPEN                "open"
+#define DUP                 "dup"
+
+
+
+/*** Redirector class ***/
+Redirector::~Redirector() {
+  for (int fd : opened) {
+    close(fd);
+  }
+}
+
+// Whether the command can see fd: set by an earlier redirection, or inherited by smash and left open to children
+bool Redirector::visible(int fd) const {
+  for (const Move& move : moves) {
+    if (move.fd == fd) {
+      return true;
+    }
+  }
+  int flags = fcntl(fd, F_GETFD);
+  return flags != -1 && !(flags & FD_CLOEXEC);
+}
+
+/**
+* Opens cmd's files and checks the fds it duplicates, printing the error and
+* returning false if one fails. An opened file is kept above every fd number
+* cmd redirects, so no dup2 in the child can close it before it is used.
+*/
+bool Redirector::open(const SimpleCommand& cmd) {
+  int max_fd = STDERR_FILENO;
+  for (int i = 0; i < cmd.redir_count; i++) {
+    max_fd = max(max_fd, cmd.redirs[i].fd);
+  }
+  for (int i = 0; i < cmd.redir_count; i++) {
+    const Redirection& redir = cmd.redirs[i];
+    int src_fd = redir.src_fd;
+    if (src_fd == -1) {
+      src_fd = ::open(redir.file, redir.flags | O_CLOEXEC, REDIRECT_FILE_MODE);
+      if (src_fd == -1) {
+        cerr << REDIRECT_ERROR(OPEN) << strerror(errno) << '\n';
+        return false;
+      }
+      if (src_fd <= max_fd) {
+        int high_fd = fcntl(src_fd, F_DUPFD_CLOEXEC, max_fd + 1);
+        close(src_fd);
+        if (high_fd == -1) {
+          cerr << REDIRECT_ERROR(DUP) << strerror(errno) << '\n';
+          return false;
+        }
+        src_fd = high_fd;
+      }
+      opened.push_back(src_fd);
+    }
+    else if (!visible(src_fd)) {
+      cerr << REDIRECT_ERROR(DUP) << strerror(EBADF) << '\n';
+      return false;
+    }
+    moves.push_back({redir.fd, src_fd});
+  }
+  return true;
+}
+
+// After whatever spec already does, e.g. the pipes of a pipeline stage
+void Redirector::addTo(SpawnSpec& spec) const {
+  for (const Move& move : moves) {
+    spec.addDup(move.src_fd, move.fd);
+  }
+}
+
+// For a forked smash, which runs shell code instead of exec'ing
+bool Redirector::apply() const {
+  for (const Move& move : moves) {
+    if (dup2(move.src_fd, move.fd) == -1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The fd of smash's that the command's fd ends up as, for builtins that stay in smash
+int Redirector::resolve(int fd) const {
+  for (size_t i = moves.size(); i > 0; i--) {
+    if (moves[i - 1].fd == fd) {
+      fd = moves[i - 1].src_fd;
+    }
+  }
+  return fd;
+}
+
+// Whether fd is a file this Redirector opened, so no other process shares its open file description
+bool Redirector::owns(int fd) const {
+  for (int opened_fd : opened) {
+    if (opened_fd == fd) {
+      return true;
+    }
+  }
+  return false;
+}
+/*** Redirector class END ***/
@@ -0,0 +1,37 @@
+#ifndef SMASH_REDIRECT_H_
+#define SMASH_REDIRECT_H_
+
+#include <vector>
+#include "parser.h"
+#include "launcher.h"
+
+#define REDIRECT_FILE_MODE (0666)
+
+/**
+* The redirections of one command, resolved to fds. smash opens the files itself,
+* O_CLOEXEC, and they are only dup2'ed onto the command's fd numbers in the child
+* at spawn time, so smash's own descriptors never move around a command.
+*/
+class Redirector {
+private:
+  class Move {
+  public:
+    int fd;
+    int src_fd;
+  };
+  std::vector<Move> moves;  // dup2(src_fd, fd) in the child, in order
+  std::vector<int> opened;
+  bool visible(int fd) const;
+public:
+  Redirector() {}
+  ~Redirector();
+  Redirector(Redirector const&) = delete;
+  void operator=(Redirector const&) = delete;
+  bool open(const SimpleCommand& cmd);
+  void addTo(SpawnSpec& spec) const;
+  bool apply() const;
+  int resolve(int fd) const;
+  bool owns(int fd) const;
+};
+
+#endif //SMASH_REDIRECT_H_
@@ -0,0 +1,112 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "script.h"
+
+using namespace std;
+
+
+
+/*** ScriptReader class ***/
+ScriptReader::ScriptReader() : fd(-1), map(nullptr), map_size(0), pos(0), waiter(nullptr) {}
+
+ScriptReader::~ScriptReader() {
+  if (map != nullptr) {
+    munmap((void*)map, map_size);
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+/**
+* Returns false with errno set if path can't be read.
+*/
+bool ScriptReader::open(const char* path) {
+  fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return false;
+  }
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem != MAP_FAILED) {
+      madvise(mem, st.st_size, MADV_SEQUENTIAL);
+      map = (const char*)mem;
+      map_size = st.st_size;
+      close(fd);
+      fd = -1;
+    }
+  }
+  return true;
+}
+
+/**
+* Reads the lines of an fd smash already has, e.g. stdin, in blocks from where it
+* stands now. The fd itself stays open.
+*/
+bool ScriptReader::attach(int fd) {
+  this->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  return this->fd != -1;
+}
+
+// Block mode calls it before each read, e.g. to get on with other work until fd is readable
+void ScriptReader::setWaiter(void (*waiter)(int fd)) {
+  this->waiter = waiter;
+}
+
+// Reads one more block onto buf, dropping the lines already handed out
+bool ScriptReader::fill() {
+  buf.erase(0, pos);
+  pos = 0;
+  size_t old_size = buf.size();
+  buf.resize(old_size + SCRIPT_BLOCK_SIZE);
+  if (waiter != nullptr) {
+    waiter(fd);
+  }
+  ssize_t len;
+  do {
+    len = read(fd, &buf[old_size], SCRIPT_BLOCK_SIZE);
+  } while (len == -1 && errno == EINTR);
+  buf.resize(old_size + ((len > 0) ? len : 0));
+  if (len <= 0) {
+    close(fd);
+    fd = -1;
+  }
+  return len > 0;
+}
+
+bool ScriptReader::nextLine(string_view& line) {
+  if (map != nullptr || fd == -1) {
+    const char* data = (map != nullptr) ? map : buf.data();
+    size_t size = (map != nullptr) ? map_size : buf.size();
+    if (pos >= size) {
+      return false;
+    }
+    const char* nl = (const char*)memchr(data + pos, '\n', size - pos);
+    size_t end = (nl != nullptr) ? nl - data : size;
+    line = string_view(data + pos, end - pos);
+    pos = end + 1;
+    return true;
+  }
+  while (true) {
+    const char* nl = (const char*)memchr(buf.data() + pos, '\n', buf.size() - pos);
+    if (nl != nullptr) {
+      size_t end = nl - buf.data();
+      line = string_view(buf.data() + pos, end - pos);
+      pos = end + 1;
+      return true;
+    }
+    if (!fill()) {
+      // the last line may lack its newline
+      return nextLine(line);
+    }
+  }
+}
+/*** ScriptReader class END ***/
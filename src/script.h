@@ -0,0 +1,36 @@
+#ifndef SMASH_SCRIPT_H_
+#define SMASH_SCRIPT_H_
+
+#include <stddef.h>
+#include <string>
+#include <string_view>
+
+#define SCRIPT_BLOCK_SIZE (64 * 1024)
+
+/**
+* Hands out the lines of a script file. A regular file is mmap'd whole; anything
+* else (a pipe, /dev/stdin) is read in SCRIPT_BLOCK_SIZE blocks as lines are
+* needed. The fd is never left open, so commands of the script can't inherit it.
+*/
+class ScriptReader {
+private:
+  int fd;
+  const char* map;      // the mapped file, or nullptr when reading blocks
+  size_t map_size;
+  size_t pos;           // start of the next line in map or buf
+  std::string buf;      // block mode: read but not yet returned
+  void (*waiter)(int fd);
+  bool fill();
+public:
+  ScriptReader();
+  ~ScriptReader();
+  ScriptReader(ScriptReader const&) = delete;
+  void operator=(ScriptReader const&) = delete;
+  bool open(const char* path);
+  bool attach(int fd);
+  void setWaiter(void (*waiter)(int fd));
+  // The view is valid until the next call
+  bool nextLine(std::string_view& line);
+};
+
+#endif //SMASH_SCRIPT_H_
@@ -3,31 +3,34 @@
 #include "signals.h"
 #include "Commands.h"
 #include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 
 
 using namespace std;
 
 
-#define _PRINT_GOT_CTRLC      std::cout << "smash: got ctrl-C" << std::endl;
-#define _PRINT_GOT_CTRLZ      std::cout << "smash: got ctrl-Z" << std::endl;
-#define _PRINT_GOT_ALRM       std::cout << "smash: got an alarm" << std::endl;
-#define _PRINT_CTRLC_EXEC(ID) std::cout << "smash: process " << ID << " was killed" << std::endl;
-#define _PRINT_CTRLZ_EXEC(ID) std::cout << "smash: process " << ID << " was stopped" << std::endl;
-#define _PRINT_ALRM_EXEC(CMD) std::cout << "smash: " << CMD << " timed out!" << std::endl;
+#define _PRINT_GOT_CTRLC      std::cout << "smash: got ctrl-C" << '\n';
+#define _PRINT_GOT_CTRLZ      std::cout << "smash: got ctrl-Z" << '\n';
+#define _PRINT_GOT_ALRM       std::cout << "smash: got an alarm" << '\n';
+#define _PRINT_CTRLC_EXEC(ID) std::cout << "smash: process " << ID << " was killed" << '\n';
+#define _PRINT_CTRLZ_EXEC(ID) std::cout << "smash: process " << ID << " was stopped" << '\n';
+#define _PRINT_ALRM_EXEC(CMD) std::cout << "smash: " << CMD << " timed out!" << '\n';
 
 
 
 void ctrlZHandler(int sig_num) {
   _PRINT_GOT_CTRLZ
   SmallShell& smash = SmallShell::getInstance();
+  smash.interrupted = sig_num;
   JobsList::JobEntry* je = smash.curr_job;
   if (je == nullptr) {
     return;
   }
   int job_pid = je->getJobPid();
   je->setStopped(true);
-  kill(job_pid, SIGSTOP);
+  je->signalJob(SIGSTOP);
   smash.curr_job = nullptr;
   _PRINT_CTRLZ_EXEC(job_pid)
 
@@ -36,15 +39,16 @@ void ctrlZHandler(int sig_num) {
 void ctrlCHandler(int sig_num) {
   _PRINT_GOT_CTRLC
   SmallShell& smash = SmallShell::getInstance();
+  smash.interrupted = sig_num;
   JobsList::JobEntry* je = smash.curr_job;
   if (je == nullptr) {
     return;
   }
   int job_id = je->getJobId();
   int job_pid = je->getJobPid();
-  smash.jl.removeJobById(job_id, false);
-  smash.timeoutlist.removeJobById(job_id, true);
-  kill(job_pid, SIGKILL);
+  je->signalJob(SIGKILL);
+  smash.jl.removeJobById(job_id);
+  smash.timers.cancel(job_pid);
   smash.curr_job = nullptr;
   _PRINT_CTRLC_EXEC(job_pid)
 }
@@ -52,24 +56,124 @@ void ctrlCHandler(int sig_num) {
 void alarmHandler(int sig_num) {
   _PRINT_GOT_ALRM
   SmallShell& smash = SmallShell::getInstance();
-  smash.timeoutlist.removeFinishedJobs(false);
-  smash.jl.removeFinishedJobs(true);
-  JobsList::JobEntry* timeout_job = smash.timeoutlist.getFirst();
-  if (timeout_job == nullptr) {
-    return;
+  smash.reapJobs();
+  TimerQueue::Timer expired;
+  while (smash.timers.popExpired(expired)) {
+    JobsList::JobEntry* timeout_job = smash.jl.getJobByPid(expired.pid);
+    if (timeout_job == nullptr) {
+      continue;
+    }
+    // the command leads its own process group, so this reaches its children too
+    if(expired.pid != smash.get_pid()) {
+      kill(-expired.pid, expired.sig);
+    }
+    if (expired.escalation) {
+      continue;
+    }
+    _PRINT_ALRM_EXEC(timeout_job->getOldCmdLine());
+    if (expired.sig != SIGKILL) {
+      if (expired.grace_nsecs >= 0) {
+        smash.timers.add(expired.pid, expired.grace_nsecs, SIGKILL, -1, true);
+      }
+      continue;
+    }
+    // a foreground job is dropped by its waiter once the kill lands
+    if (timeout_job == smash.curr_job) {
+      smash.curr_job = nullptr;
+    }
+    else {
+      smash.jl.removeJobById(timeout_job->getJobId());
+    }
   }
-  int job_id = timeout_job->getJobId();
-  if (smash.curr_job != nullptr && smash.curr_job->getJobId() == job_id) {
-    smash.curr_job = nullptr;
+  smash.timers.arm();
+}
+
+/**
+* Reaps every child that has exited; their jobs are dropped by SmallShell::reapJobs.
+* Once the queue is full the rest stay zombies, so no status is lost, until a drain
+* calls this again.
+*/
+void chldHandler(int sig_num) {
+  int status;
+  struct rusage ru;
+  pid_t pid;
+  while (!ReapQueue::full()) {
+    pid = wait4(-1, &status, WNOHANG, &ru);
+    if (pid <= 0) {
+      return;
+    }
+    ReapQueue::push(pid, status, ru);
+  }
+  ReapQueue::setOverflow();
+}
+
+
+
+/*** Usage class ***/
+void Usage::add(const struct rusage& ru) {
+  user_usecs += ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec;
+  sys_usecs += ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+  if (ru.ru_maxrss > maxrss_kb) {
+    maxrss_kb = ru.ru_maxrss;
   }
-  if(timeout_job->getJobPid() != smash.get_pid()) {
-    kill(timeout_job->getJobPid(), SIGKILL);
+  vcsw += ru.ru_nvcsw;
+  ivcsw += ru.ru_nivcsw;
+}
+
+void Usage::add(const Usage& other) {
+  user_usecs += other.user_usecs;
+  sys_usecs += other.sys_usecs;
+  if (other.maxrss_kb > maxrss_kb) {
+    maxrss_kb = other.maxrss_kb;
   }
-  _PRINT_ALRM_EXEC(timeout_job->getOldCmdLine());
-  smash.timeoutlist.removeJobById(job_id, false);
-  smash.jl.removeJobById(job_id);
-  smash.timeoutlist.sortTimeout();
-  smash.timeoutlist.setAlarm();
+  vcsw += other.vcsw;
+  ivcsw += other.ivcsw;
 }
+/*** Usage class END ***/
+
+
 
+/*** ReapQueue class ***/
+static ReapQueue::Entry reap_ring[REAP_QUEUE_SIZE];
+static int reap_head = 0;
+static int reap_tail = 0;
+static bool reap_overflow = false;
 
+bool ReapQueue::full() {
+  return (reap_tail + 1) % REAP_QUEUE_SIZE == reap_head;
+}
+
+void ReapQueue::push(pid_t pid, int status, const struct rusage& ru) {
+  int next = (reap_tail + 1) % REAP_QUEUE_SIZE;
+  if (next == reap_head) {
+    return;
+  }
+  reap_ring[reap_tail].pid = pid;
+  reap_ring[reap_tail].status = status;
+  reap_ring[reap_tail].usage = Usage();
+  reap_ring[reap_tail].usage.add(ru);
+  reap_tail = next;
+}
+
+bool ReapQueue::pop(Entry& entry) {
+  if (reap_head == reap_tail) {
+    return false;
+  }
+  entry = reap_ring[reap_head];
+  reap_head = (reap_head + 1) % REAP_QUEUE_SIZE;
+  return true;
+}
+
+void ReapQueue::setOverflow() {
+  reap_overflow = true;
+}
+
+// True (once) if chldHandler left children unreaped because the ring was full
+bool ReapQueue::takeOverflow() {
+  if (!reap_overflow) {
+    return false;
+  }
+  reap_overflow = false;
+  return true;
+}
+/*** ReapQueue class END ***/
@@ -2,8 +2,48 @@
 #define SMASH__SIGNALS_H_
 
 
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define REAP_QUEUE_SIZE (4096)
+
+// Run by the EventLoop on the main flow, never from signal context
 void ctrlZHandler(int sig_num);
 void ctrlCHandler(int sig_num);
 void alarmHandler(int sig_num);
+void chldHandler(int sig_num);
+
+/**
+* What wait4(2) reported for a process, or summed over the processes of a job.
+*/
+class Usage {
+public:
+  long long user_usecs;
+  long long sys_usecs;
+  long maxrss_kb;   // of the biggest process, not a sum
+  long vcsw;        // voluntary context switches
+  long ivcsw;       // involuntary ones
+  void add(const struct rusage& ru);
+  void add(const Usage& other);
+};
+
+/**
+* Children reaped by chldHandler, waiting for their jobs to be dropped or for a
+* foreground wait to claim them.
+*/
+class ReapQueue {
+public:
+  class Entry {
+  public:
+    pid_t pid;
+    int status;
+    Usage usage;
+  };
+  static bool full();
+  static void push(pid_t pid, int status, const struct rusage& ru);
+  static bool pop(Entry& entry);
+  static void setOverflow();
+  static bool takeOverflow();
+};
 
 #endif //SMASH__SIGNALS_H_
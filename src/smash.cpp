@@ -2,8 +2,14 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <iomanip>
 #include "Commands.h"
 #include "signals.h"
+#include "output.h"
+#include "script.h"
 
 /***
  *  TODO:
@@ -16,32 +22,111 @@
  *      - Test Timeout
  ***/
 
+#define USAGE "usage: smash [-i] [-e] [-v] [--unbuffered] [--spawn=BACKEND] [-c COMMAND | FILE]"
+
+static double _secsSince(const struct timespec& start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
 int main(int argc, char* argv[]) {
-    if(signal(SIGTSTP , ctrlZHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-Z handler");
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool unbuffered = false;
+    bool interactive = isatty(STDIN_FILENO);
+    bool errexit = false;
+    bool verbose = false;
+    const char* command = nullptr;
+    const char* script = nullptr;
+    const char* bad_option = nullptr;
+    SmallShell& smash = SmallShell::getInstance();
+    // options come first; the first other word is the script, as in sh
+    for (int i = 1; i < argc && script == nullptr && command == nullptr; i++) {
+        if (strcmp(argv[i], "--unbuffered") == 0) {
+            unbuffered = true;
+        }
+        else if (strcmp(argv[i], "-i") == 0) {
+            interactive = true;
+        }
+        else if (strcmp(argv[i], "-e") == 0) {
+            errexit = true;
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            command = argv[++i];
+        }
+        else if (strncmp(argv[i], "--spawn=", 8) == 0 && smash.launcher.setBackend(argv[i] + 8)) {
+            continue;
+        }
+        else if (argv[i][0] != '-') {
+            script = argv[i];
+        }
+        else if (bad_option == nullptr) {
+            bad_option = argv[i];
+        }
     }
-    if(signal(SIGINT , ctrlCHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
+    installOutput(unbuffered);
+    if (bad_option != nullptr) {
+        std::cerr << "smash error: invalid option " << bad_option << '\n' << USAGE << '\n';
+        return 2;
     }
-    /*
-    if(signal(SIGALRM , alarmHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
-    }*/
-    struct sigaction a;
-    a.sa_handler = alarmHandler;
-    sigemptyset(&a.sa_mask);
-    a.sa_flags = SA_RESTART;
-    if (sigaction(SIGALRM, &a, nullptr) == -1) {
-        perror("smash error: failed to set alarm handler");
+    // from here on signals only reach smash through its event loop
+    if (!smash.events.init(smash.timers.getFd())) {
+        perror("smash error: failed to set up the event loop");
+        return 1;
     }
-    SmallShell& smash = SmallShell::getInstance();
-    while(true) {
-        setbuf(stdout, NULL);
-        //setbuf(stderr, NULL);
-        std::cout << smash.getPrompt() << "> ";
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        smash.executeCommand(cmd_line.c_str());
+
+    long lines = 0;
+    if (command != nullptr) {
+        smash.executeCommand(command);
+        lines = 1;
+    }
+    else if (script != nullptr) {
+        ScriptReader reader;
+        if (!reader.open(script)) {
+            std::cerr << "smash error: " << script << ": " << strerror(errno) << '\n';
+            return 127;
+        }
+        std::string_view line;
+        while (reader.nextLine(line)) {
+            smash.executeCommand(line);
+            lines++;
+            if (errexit && smash.getStatus() != 0) {
+                break;
+            }
+        }
+    }
+    else {
+        // read through the event loop, so ctrl-C, ctrl-Z and finished jobs are
+        // handled while smash sits at the prompt
+        ScriptReader input;
+        input.attach(STDIN_FILENO);
+        input.setWaiter([](int fd) {
+            while (!SmallShell::getInstance().events.wait(fd)) {
+            }
+        });
+        std::string_view cmd_line;
+        while (true) {
+            if (interactive) {
+                std::cout << smash.getPrompt() << "> ";
+                flushOutput();
+            }
+            if (!input.nextLine(cmd_line)) {
+                break;
+            }
+            smash.executeCommand(cmd_line);
+            lines++;
+            if (errexit && smash.getStatus() != 0) {
+                break;
+            }
+        }
+    }
+    if (verbose) {
+        std::cerr << "smash: " << lines << " lines, " << smash.launcher.getSpawns() << " commands spawned, "
+                  << std::fixed << std::setprecision(3) << _secsSince(start) << " secs" << '\n';
     }
-    return 0;
-}
\ No newline at end of file
+    return smash.getStatus();
+}
@@ -0,0 +1,167 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include "timers.h"
+
+using namespace std;
+
+#define SYSCALL_ERROR(CMD)  "smash error: " CMD " failed"
+#define TIMERFD_CREATE      "timerfd_create"
+
+// Later deadlines sink, so the heap front is always the earliest one
+static bool _timerIsLater(const TimerQueue::Timer& a, const TimerQueue::Timer& b) {
+  return (a.deadline != b.deadline) ? a.deadline > b.deadline : a.seq > b.seq;
+}
+
+/*** TimerQueue class ***/
+TimerQueue::TimerQueue() : next_seq(0) {
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    perror(SYSCALL_ERROR(TIMERFD_CREATE));
+  }
+}
+
+TimerQueue::~TimerQueue() {
+  if (timer_fd != -1) {
+    close(timer_fd);
+  }
+}
+
+bool TimerQueue::isLive(const Timer& t) {
+  auto iter = live.find(t.pid);
+  return iter != live.end() && iter->second == t.seq;
+}
+
+void TimerQueue::popTop() {
+  pop_heap(heap.begin(), heap.end(), _timerIsLater);
+  heap.pop_back();
+}
+
+// The deadline is fixed here, once, relative to the monotonic clock; one past LLONG_MAX never comes
+void TimerQueue::add(pid_t pid, long long delay_nsecs, int sig, long long grace_nsecs, bool escalation) {
+  long long curr = now();
+  long long deadline = (delay_nsecs > LLONG_MAX - curr) ? LLONG_MAX : curr + delay_nsecs;
+  Timer t = {deadline, pid, next_seq++, sig, grace_nsecs, escalation};
+  live[pid] = t.seq;
+  heap.push_back(t);
+  push_heap(heap.begin(), heap.end(), _timerIsLater);
+}
+
+void TimerQueue::cancel(pid_t pid) {
+  live.erase(pid);
+}
+
+/**
+* Pops the next live timer whose deadline has passed, dropping stale ones on the way.
+*/
+bool TimerQueue::popExpired(Timer& expired) {
+  long long curr = now();
+  while (!heap.empty() && heap.front().deadline <= curr) {
+    Timer t = heap.front();
+    popTop();
+    if (isLive(t)) {
+      live.erase(t.pid);
+      expired = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Arms the timerfd for the earliest live deadline, or disarms it if there is none
+void TimerQueue::arm() {
+  while (!heap.empty() && !isLive(heap.front())) {
+    popTop();
+  }
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (!heap.empty()) {
+    spec.it_value.tv_sec = heap.front().deadline / NSECS_PER_SEC;
+    spec.it_value.tv_nsec = heap.front().deadline % NSECS_PER_SEC;
+  }
+  timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+int TimerQueue::getFd() {
+  return timer_fd;
+}
+
+/**
+* For a forked smash: the parent's deadlines are not its business, and the timerfd
+* would be shared with the parent, so it starts over with a new one.
+*/
+void TimerQueue::reset() {
+  heap.clear();
+  live.clear();
+  if (timer_fd != -1) {
+    close(timer_fd);
+  }
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+size_t TimerQueue::size() {
+  return live.size();
+}
+
+long long TimerQueue::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+* Parses "10", "1.5s", "250ms", "2m", "1h" or "1d" into nanoseconds.
+* The number is digits with an optional fraction; exponents, hex, signs, inf
+* and nan are -1 like anything else, and so are durations too long to count
+* in nanoseconds (about 292 years).
+*/
+long long TimerQueue::parseDuration(const char* arg) {
+  const char* end = arg;
+  while (isdigit((unsigned char)*end)) {
+    end++;
+  }
+  bool whole = (end != arg);
+  bool fraction = false;
+  if (*end == '.') {
+    end++;
+    while (isdigit((unsigned char)*end)) {
+      end++;
+      fraction = true;
+    }
+  }
+  if (!whole && !fraction) {
+    return -1;
+  }
+  // none of the units below can continue a number, so strtod reads just the digits scanned
+  double value = strtod(arg, nullptr);
+  double scale;
+  if (*end == '\0' || strcmp(end, "s") == 0) {
+    scale = NSECS_PER_SEC;
+  }
+  else if (strcmp(end, "ms") == 0) {
+    scale = NSECS_PER_SEC / 1000;
+  }
+  else if (strcmp(end, "m") == 0) {
+    scale = 60.0 * NSECS_PER_SEC;
+  }
+  else if (strcmp(end, "h") == 0) {
+    scale = 3600.0 * NSECS_PER_SEC;
+  }
+  else if (strcmp(end, "d") == 0) {
+    scale = 86400.0 * NSECS_PER_SEC;
+  }
+  else {
+    return -1;
+  }
+  if (value * scale >= (double)LLONG_MAX) {
+    return -1;
+  }
+  return (long long)(value * scale);
+}
+/*** TimerQueue class END ***/
@@ -0,0 +1,51 @@
+#ifndef SMASH_TIMERS_H_
+#define SMASH_TIMERS_H_
+
+#include <sys/types.h>
+#include <signal.h>
+#include <time.h>
+#include <vector>
+#include <unordered_map>
+
+#define NSECS_PER_SEC (1000000000LL)
+
+/**
+* Pending timeout deadlines, kept in a min-heap on CLOCK_MONOTONIC nanoseconds.
+* A pid has at most one live timer: its timeout, then possibly its escalation.
+* Cancelling only forgets the pid; its stale heap entry is skipped once it
+* reaches the top. A single timerfd is armed for the earliest live deadline, and
+* the event loop runs alarmHandler when it expires.
+*/
+class TimerQueue {
+public:
+  class Timer {
+  public:
+    long long deadline;
+    pid_t pid;
+    unsigned long seq;
+    int sig;                // sent to the job's process group on expiry
+    long long grace_nsecs;  // if >= 0, SIGKILL follows this long after sig
+    bool escalation;        // the follow-up SIGKILL of an earlier timer
+  };
+private:
+  std::vector<Timer> heap;
+  std::unordered_map<pid_t, unsigned long> live;
+  unsigned long next_seq;
+  int timer_fd;
+  bool isLive(const Timer& t);
+  void popTop();
+public:
+  TimerQueue();
+  ~TimerQueue();
+  void add(pid_t pid, long long delay_nsecs, int sig = SIGKILL, long long grace_nsecs = -1, bool escalation = false);
+  void cancel(pid_t pid);
+  bool popExpired(Timer& expired);
+  void arm();
+  int getFd();
+  void reset();
+  size_t size();
+  static long long now();
+  static long long parseDuration(const char* arg);
+};
+
+#endif //SMASH_TIMERS_H_
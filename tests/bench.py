@@ -0,0 +1,208 @@
+#!/usr/bin/python3
+
+import subprocess
+import argparse
+import datetime
+import platform
+import random
+import shutil
+import time
+import json
+import os
+
+BENCH_DIR = '/tmp/smash_bench'
+BIG_FILE = BENCH_DIR + '/big'
+TEE_FILE = BENCH_DIR + '/tee_out'
+CAT_FILE = BENCH_DIR + '/cat_out'
+SCRIPT_FILE = BENCH_DIR + '/script'
+MB = 1024 * 1024
+SEED = 318188547
+
+# Each case runs through smash once with the builtin and once with the coreutils binary
+CASES = [
+    ("cat big | head -c {n}", "cat big | /usr/bin/head -c {n}"),
+    ("cat big | tee tee_out | cat", "cat big | /usr/bin/tee tee_out | cat"),
+    ("head -c {n} big", "/usr/bin/head -c {n} big"),
+    ("cat big > cat_out", "/usr/bin/cat big > cat_out"),
+]
+
+SPAWN_BACKENDS = ["fork", "vfork", "posix_spawn", "clone"]
+PIPELINE_STAGES = [2, 4, 8]
+JOB_COUNTS = [10, 100, 1000]
+JOB_QUERIES = 1000
+TIMEOUT_SECS = 0.05
+TIMEOUT_RUNS = 20
+
+
+class Shell:
+    """How to run a script in one shell, and the few lines that differ between them."""
+    def __init__(self, name, argv, kill_all, kill_one):
+        self.name = name
+        self.argv = argv
+        self.kill_all = kill_all
+        self.kill_one = kill_one
+
+    def run(self, lines):
+        with open(SCRIPT_FILE, 'w') as f:
+            f.write("\n".join(lines) + "\n")
+        start = time.monotonic()
+        subprocess.run(self.argv + [SCRIPT_FILE], cwd=BENCH_DIR, stdin=subprocess.DEVNULL,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        return time.monotonic() - start
+
+
+def smash_shell(smash, spawn=None):
+    argv = [smash] + ([f"--spawn={spawn}"] if spawn else [])
+    name = "smash" + (f" --spawn={spawn}" if spawn else "")
+    return Shell(name, argv, "quit kill", "kill -0 1")
+
+
+def posix_shell(name):
+    path = shutil.which(name)
+    if path is None:
+        return None
+    return Shell(name, [path], "kill -9 $(jobs -p)", "kill -0 %1")
+
+
+def prepare_env(size_mb):
+    os.makedirs(BENCH_DIR, exist_ok=True)
+    if os.path.exists(BIG_FILE) and os.path.getsize(BIG_FILE) == size_mb * MB:
+        return
+    # the same bytes every time, so runs on different versions stream identical input
+    block = random.Random(SEED).randbytes(MB)
+    with open(BIG_FILE, 'wb') as f:
+        for _ in range(size_mb):
+            f.write(block)
+
+
+class Bench:
+    def __init__(self, rounds):
+        self.rounds = rounds
+        self.results = []
+
+    def best(self, shell, lines):
+        return min(shell.run(lines) for _ in range(self.rounds))
+
+    def record(self, bench, shell, case, value, unit):
+        self.results.append({"bench": bench, "shell": shell.name if shell else "smash",
+                             "case": case, "value": round(value, 3), "unit": unit})
+        print(f"{bench:9} {self.results[-1]['shell']:22} {case:45} {value:14.3f} {unit}")
+
+    # trivial externals, so the time is the shell's fork/exec/wait path
+    def spawn(self, shell, count):
+        secs = self.best(shell, ["/bin/true"] * count)
+        self.record("spawn", shell, "/bin/true", count / secs, "cmds/s")
+
+    # a builtin every shell has, so nothing is spawned
+    def dispatch(self, shell, count):
+        secs = self.best(shell, ["pwd"] * count)
+        self.record("dispatch", shell, "pwd", count / secs, "cmds/s")
+
+    def pipeline(self, shell, stages, size_mb):
+        cmd = " | ".join(["cat big"] + ["cat"] * (stages - 1))
+        secs = self.best(shell, [cmd])
+        self.record("pipeline", shell, f"{stages} stages", size_mb / secs, "MB/s")
+
+    # the cost of one jobs or kill, with the table holding count jobs: timed against
+    # the same script without the queries, so starting the jobs drops out
+    def job_table(self, shell, count):
+        start = ["sleep 1000 &"] * count
+        base = self.best(shell, start + [shell.kill_all])
+        for query in ("jobs", shell.kill_one):
+            secs = self.best(shell, start + [query] * JOB_QUERIES + [shell.kill_all])
+            usecs = max(secs - base, 0) / JOB_QUERIES * 1e6
+            self.record("jobs", shell, f"{query.split()[0]} with {count} jobs", usecs, "us")
+
+    # how late a timeout fires, spawning the command included
+    def timeout(self, shell):
+        secs = self.best(shell, [f"timeout {TIMEOUT_SECS} sleep 10"] * TIMEOUT_RUNS)
+        late_ms = (secs / TIMEOUT_RUNS - TIMEOUT_SECS) * 1e3
+        self.record("timeout", shell, f"timeout {TIMEOUT_SECS} sleep 10", late_ms, "ms late")
+
+    def stream(self, shell, size_mb):
+        for builtin, external in CASES:
+            for cmd in (builtin, external):
+                cmd = cmd.format(n=size_mb * MB)
+                secs = self.best(shell, [cmd])
+                self.record("stream", shell, cmd, size_mb / 1024 / secs, "GB/s")
+
+    def micro(self, bench_bin):
+        out = subprocess.run([bench_bin, "--json"], capture_output=True, text=True, check=True).stdout
+        for row in json.loads(out):
+            self.record(row["group"], None, row["case"], row["value"], row["unit"])
+
+
+def compare(results, baseline_path):
+    with open(baseline_path) as f:
+        baseline = {(r["bench"], r["shell"], r["case"]): r for r in json.load(f)["results"]}
+    print(f"\nchange against {baseline_path}:")
+    for r in results:
+        old = baseline.get((r["bench"], r["shell"], r["case"]))
+        if old is None or old["value"] == 0:
+            continue
+        change = (r["value"] - old["value"]) / old["value"] * 100
+        print(f"{r['bench']:9} {r['shell']:22} {r['case']:45} {change:+8.1f}% {r['unit']}")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-smash', type=str, default="./smash")
+    parser.add_argument('-micro', type=str, default=None, help="the microbench binary, for parse/dispatch micro-benchmarks")
+    parser.add_argument('-size', type=int, default=2048, help="size of the streamed file in MB")
+    parser.add_argument('-rounds', type=int, default=3, help="best of this many runs")
+    parser.add_argument('-count', type=int, default=2000, help="lines in the spawn and dispatch scripts")
+    parser.add_argument('-shells', type=str, default="bash,dash", help="shells to compare against, if installed")
+    parser.add_argument('-only', type=str, default=None, help="comma separated benches to run")
+    parser.add_argument('-json', type=str, default=None, help="write the results here")
+    parser.add_argument('-baseline', type=str, default=None, help="earlier -json output to compare with")
+    args = parser.parse_args()
+
+    smash = smash_shell(os.path.abspath(args.smash))
+    others = [s for s in (posix_shell(name) for name in args.shells.split(",") if name) if s is not None]
+    shells = [smash] + others
+    only = set(args.only.split(",")) if args.only else None
+    def wanted(name):
+        return only is None or name in only
+
+    prepare_env(args.size)
+    bench = Bench(args.rounds)
+    if wanted("spawn"):
+        for shell in [smash_shell(smash.argv[0], spawn) for spawn in SPAWN_BACKENDS] + others:
+            bench.spawn(shell, args.count)
+    if wanted("dispatch"):
+        for shell in shells:
+            bench.dispatch(shell, args.count * 10)
+        if args.micro:
+            bench.micro(os.path.abspath(args.micro))
+    if wanted("pipeline"):
+        for shell in shells:
+            for stages in PIPELINE_STAGES:
+                bench.pipeline(shell, stages, args.size)
+    if wanted("jobs"):
+        for shell in shells:
+            for count in JOB_COUNTS:
+                bench.job_table(shell, count)
+    if wanted("timeout"):
+        for shell in shells:
+            bench.timeout(shell)
+    if wanted("stream"):
+        bench.stream(smash, args.size)
+    for leftover in (TEE_FILE, CAT_FILE, SCRIPT_FILE):
+        if os.path.exists(leftover):
+            os.remove(leftover)
+
+    if args.json:
+        report = {
+            "date": datetime.datetime.now().isoformat(timespec="seconds"),
+            "host": {"system": platform.platform(), "cpus": os.cpu_count()},
+            "config": {"size_mb": args.size, "rounds": args.rounds, "count": args.count},
+            "results": bench.results,
+        }
+        with open(args.json, 'w') as f:
+            json.dump(report, f, indent=2)
+    if args.baseline:
+        compare(bench.results, args.baseline)
+
+
+if __name__ == "__main__":
+    main()
@@ -58,11 +58,12 @@ def run_test(execu, test, valgrind):
     i = open(input, 'r')
 
     smash_abs_path = os.path.abspath(execu)
-    exec_args = [smash_abs_path]
+    # -i: smash stays interactive (prompts and all) although its stdin is a pipe
+    exec_args = [smash_abs_path, '-i']
 
     valgrind_path = os.getcwd() + '/' + test + '.mem'
     if valgrind:
-        exec_args = ['valgrind', '-v', '--leak-check=full', '--log-file=' + valgrind_path, smash_abs_path]
+        exec_args = ['valgrind', '-v', '--leak-check=full', '--log-file=' + valgrind_path, smash_abs_path, '-i']
 
     p = subprocess.Popen(exec_args, stdin=subprocess.PIPE,
                             stdout=o, stderr=subprocess.STDOUT, cwd=TEST_DIR)